@@ -0,0 +1,253 @@
+//
+//  Copyright (C) 2013 Greg Landrum
+//
+//  @@ All Rights Reserved @@
+//  This file is part of the RDKit.
+//  The contents are covered by the terms of the BSD license
+//  which is included in the file license.txt, found at the root
+//  of the RDKit source tree.
+//
+#ifndef __RD_BLOCKEDMETRICMATRIXCALC_H__
+#define __RD_BLOCKEDMETRICMATRIXCALC_H__
+/*! \file BlockedMetricMatrixCalc.h
+
+  \brief Multi-threaded, cache-blocked metric matrix calculation.
+
+  These are faster alternatives to MetricMatrixCalc for the two most
+  common cases: Tanimoto similarity/distance between ExplicitBitVects
+  and Euclidean distance between rows of a matrix of doubles.
+
+  The results use the same layout as MetricMatrixCalc: the lower
+  triangle of the matrix, row by row, so element (i,j) with j<i is at
+  position <tt>i*(i-1)/2+j</tt>. The output type can be either double
+  or float; using float halves the memory required.
+
+  The matrix is calculated in square tiles so that the data for a
+  block of rows and a block of columns stays in cache while the tile
+  is done. Blocks of rows are distributed across threads.
+
+*/
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <RDGeneral/Invariant.h>
+#include <RDGeneral/RDThreads.h>
+#include <DataStructs/ExplicitBitVect.h>
+#include <DataStructs/FingerprintArena.h>
+#include <DataStructs/BitmapOps.h>
+
+#ifdef RDK_THREADSAFE_SSS
+#include <boost/thread.hpp>
+#endif
+
+namespace RDDataManip {
+  //! the default number of rows and columns in each tile
+  const unsigned int defaultMetricMatrixBlockSize=64;
+
+  namespace detail {
+    //! the position of the first element of row \c i in the lower triangle
+    inline size_t triangleRowStart(size_t i){
+      return i ? i*(i-1)/2 : 0;
+    }
+
+    //! Tanimoto similarity (or distance) between two fingerprints in an arena
+    class ArenaTanimotoFunctor {
+    public:
+      ArenaTanimotoFunctor(const RDKit::FingerprintArena &fps,bool returnDistance) :
+        dp_fps(&fps), d_returnDistance(returnDistance),
+        d_stride(fps.getStride()) {};
+      double operator()(unsigned int i,unsigned int j) const {
+        unsigned int x=CalcBitmapNumBitsInCommon(dp_fps->getBitmap(i),
+                                                 dp_fps->getBitmap(j),
+                                                 d_stride);
+        unsigned int denom=dp_fps->getPopcount(i)+dp_fps->getPopcount(j)-x;
+        double sim = denom ? static_cast<double>(x)/denom : 1.0;
+        return d_returnDistance ? 1.0-sim : sim;
+      }
+    private:
+      const RDKit::FingerprintArena *dp_fps;
+      bool d_returnDistance;
+      unsigned int d_stride;
+    };
+
+    //! Euclidean distance between two rows of a (row-major) matrix
+    class EuclideanFunctor {
+    public:
+      EuclideanFunctor(const double *descripts,unsigned int dim) :
+        dp_descripts(descripts), d_dim(dim) {};
+      double operator()(unsigned int i,unsigned int j) const {
+        const double *v1=dp_descripts+static_cast<size_t>(i)*d_dim;
+        const double *v2=dp_descripts+static_cast<size_t>(j)*d_dim;
+        double dist=0.0;
+        for(unsigned int k=0;k<d_dim;++k){
+          double diff=v1[k]-v2[k];
+          dist+=diff*diff;
+        }
+        return sqrt(dist);
+      }
+    private:
+      const double *dp_descripts;
+      unsigned int d_dim;
+    };
+
+    //! calculates rows [firstRow,lastRow) of the lower triangle
+    /*!
+      \c res points to the storage for row \c firstRow. Tiles of rows
+      are striped across threads: this thread does tiles \c threadIdx,
+      <tt>threadIdx+numThreads</tt>, ...
+    */
+    template <typename T,typename PairFunctor>
+    void calcTriangleRows(const PairFunctor *func,
+                          unsigned int firstRow,unsigned int lastRow,
+                          T *res,unsigned int blockSize,
+                          unsigned int threadIdx,unsigned int numThreads){
+      const size_t offset=triangleRowStart(firstRow);
+      for(unsigned int rowBlock=firstRow+threadIdx*blockSize;rowBlock<lastRow;
+          rowBlock+=numThreads*blockSize){
+        unsigned int rowEnd=std::min(rowBlock+blockSize,lastRow);
+        for(unsigned int colBlock=0;colBlock<rowEnd-1;colBlock+=blockSize){
+          unsigned int colEnd=colBlock+blockSize;
+          for(unsigned int i=rowBlock;i<rowEnd;++i){
+            T *row=res+triangleRowStart(i)-offset;
+            unsigned int jEnd=std::min(colEnd,i);
+            for(unsigned int j=colBlock;j<jEnd;++j){
+              row[j]=static_cast<T>((*func)(i,j));
+            }
+          }
+        }
+      }
+    }
+
+    template <typename T,typename PairFunctor>
+    void calcTriangleRowsThreaded(const PairFunctor &func,
+                                  unsigned int firstRow,unsigned int lastRow,
+                                  T *res,unsigned int blockSize,int numThreads){
+      PRECONDITION(blockSize>0,"bad blockSize");
+      unsigned int nBlocks=(lastRow-firstRow+blockSize-1)/blockSize;
+      unsigned int nThreads=std::min(RDKit::getNumThreadsToUse(numThreads),nBlocks);
+      if(nThreads<=1){
+        calcTriangleRows(&func,firstRow,lastRow,res,blockSize,0,1);
+      }
+#ifdef RDK_THREADSAFE_SSS
+      else {
+        boost::thread_group tg;
+        for(unsigned int ti=0;ti<nThreads;++ti){
+          tg.add_thread(new boost::thread(calcTriangleRows<T,PairFunctor>,&func,
+                                          firstRow,lastRow,res,blockSize,ti,nThreads));
+        }
+        tg.join_all();
+      }
+#endif
+    }
+
+    template <typename T,typename PairFunctor,typename BlockFunctor>
+    void streamTriangleRows(const PairFunctor &func,unsigned int nItems,
+                            BlockFunctor &blockFunc,unsigned int rowsPerBlock,
+                            int numThreads,unsigned int blockSize){
+      PRECONDITION(rowsPerBlock>0,"bad rowsPerBlock");
+      std::vector<T> buffer;
+      for(unsigned int firstRow=1;firstRow<nItems;firstRow+=rowsPerBlock){
+        unsigned int lastRow=std::min(firstRow+rowsPerBlock,nItems);
+        buffer.resize(triangleRowStart(lastRow)-triangleRowStart(firstRow));
+        calcTriangleRowsThreaded(func,firstRow,lastRow,&buffer[0],blockSize,numThreads);
+        blockFunc(firstRow,lastRow,static_cast<const T *>(&buffer[0]));
+      }
+    }
+  }
+
+  //! calculates the Tanimoto distance (or similarity) matrix for a set of fingerprints
+  /*!
+    \param fps            the fingerprints
+    \param res            used to return the lower triangle of the matrix, must
+                          have room for <tt>n*(n-1)/2</tt> values
+    \param returnDistance toggles returning 1-similarity
+    \param numThreads     the number of threads to use (see getNumThreadsToUse())
+    \param blockSize      the size of the tiles
+  */
+  template <typename T>
+  void calcTanimotoMetricMatrix(const RDKit::FingerprintArena &fps,T *res,
+                                bool returnDistance=true,int numThreads=1,
+                                unsigned int blockSize=defaultMetricMatrixBlockSize){
+    PRECONDITION(res || fps.size()<2,"no result array");
+    if(fps.size()<2) return;
+    detail::ArenaTanimotoFunctor func(fps,returnDistance);
+    detail::calcTriangleRowsThreaded(func,1,fps.size(),res,blockSize,numThreads);
+  }
+  //! \overload
+  /*!
+    The fingerprints are copied into a FingerprintArena first; all of
+    them must be the same size.
+  */
+  template <typename T>
+  void calcTanimotoMetricMatrix(const std::vector<const ExplicitBitVect *> &fps,T *res,
+                                bool returnDistance=true,int numThreads=1,
+                                unsigned int blockSize=defaultMetricMatrixBlockSize){
+    if(fps.empty()) return;
+    RDKit::FingerprintArena arena(fps[0]->getNumBits());
+    arena.reserve(fps.size());
+    for(unsigned int i=0;i<fps.size();++i){
+      PRECONDITION(fps[i],"bad fingerprint");
+      arena.addFingerprint(*fps[i]);
+    }
+    calcTanimotoMetricMatrix(arena,res,returnDistance,numThreads,blockSize);
+  }
+
+  //! calculates the Euclidean distance matrix for a set of descriptor vectors
+  /*!
+    \param descripts   the descriptors, \c nItems rows of \c dim values stored contiguously
+    \param nItems      the number of descriptor vectors
+    \param dim         the number of descriptors in each vector
+    \param res         used to return the lower triangle of the matrix, must
+                       have room for <tt>nItems*(nItems-1)/2</tt> values
+    \param numThreads  the number of threads to use (see getNumThreadsToUse())
+    \param blockSize   the size of the tiles
+  */
+  template <typename T>
+  void calcEuclideanMetricMatrix(const double *descripts,unsigned int nItems,
+                                 unsigned int dim,T *res,int numThreads=1,
+                                 unsigned int blockSize=defaultMetricMatrixBlockSize){
+    PRECONDITION(descripts || nItems<2,"no descriptors");
+    PRECONDITION(res || nItems<2,"no result array");
+    if(nItems<2) return;
+    detail::EuclideanFunctor func(descripts,dim);
+    detail::calcTriangleRowsThreaded(func,1,nItems,res,blockSize,numThreads);
+  }
+
+  //! \name Streaming calculations
+  /*!
+    These calculate the matrix a block of rows at a time and pass each
+    block to \c blockFunc, so the full matrix never needs to be held in
+    memory. \c blockFunc is called in order from the calling thread as:
+
+      <tt>blockFunc(unsigned int firstRow,unsigned int lastRow,const T *vals)</tt>
+
+    where \c vals contains the lower triangle elements of rows
+    <tt>[firstRow,lastRow)</tt> in the usual layout; row \c i has \c i
+    elements. Row 0 is empty, so the first block starts at row 1.
+    \c vals is only valid during the call.
+  */
+  //@{
+  template <typename T,typename BlockFunctor>
+  void streamTanimotoMetricMatrix(const RDKit::FingerprintArena &fps,
+                                  BlockFunctor &blockFunc,unsigned int rowsPerBlock,
+                                  bool returnDistance=true,int numThreads=1,
+                                  unsigned int blockSize=defaultMetricMatrixBlockSize){
+    detail::ArenaTanimotoFunctor func(fps,returnDistance);
+    detail::streamTriangleRows<T>(func,fps.size(),blockFunc,rowsPerBlock,
+                                  numThreads,blockSize);
+  }
+  template <typename T,typename BlockFunctor>
+  void streamEuclideanMetricMatrix(const double *descripts,unsigned int nItems,
+                                   unsigned int dim,BlockFunctor &blockFunc,
+                                   unsigned int rowsPerBlock,int numThreads=1,
+                                   unsigned int blockSize=defaultMetricMatrixBlockSize){
+    PRECONDITION(descripts || nItems<2,"no descriptors");
+    detail::EuclideanFunctor func(descripts,dim);
+    detail::streamTriangleRows<T>(func,nItems,blockFunc,rowsPerBlock,
+                                  numThreads,blockSize);
+  }
+  //@}
+}
+
+#endif
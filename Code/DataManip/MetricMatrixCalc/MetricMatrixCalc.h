@@ -73,7 +73,7 @@ namespace RDDataManip {
       CHECK_INVARIANT(distMat, "invalid pointer to a distance matix");
       
       for (unsigned int i = 1; i < nItems; i++) {
-        unsigned int itab = i*(i-1)/2;
+        size_t itab = static_cast<size_t>(i)*(i-1)/2;
         for (unsigned int j = 0; j < i; j++) {
           distMat[itab+j] = dp_metricFunc(descripts[i], descripts[j], dim);
         }
@@ -19,6 +19,7 @@
 #include <RDGeneral/types.h>
 
 #include <DataManip/MetricMatrixCalc/MetricMatrixCalc.h>
+#include <DataManip/MetricMatrixCalc/BlockedMetricMatrixCalc.h>
 #include <DataManip/MetricMatrixCalc/MetricFuncs.h>
 #include <DataStructs/BitVects.h>
 #include <string>
@@ -29,6 +30,16 @@ void wrap_MMcalc();
 
 namespace python = boost::python;
 namespace RDDataManip {
+  void getTanimotoMatFromEBVs(python::object bitVectList,unsigned int nrows,
+                              double *res,bool returnDistance,int numThreads){
+    unsigned int nBits=python::extract<ExplicitBitVect>(bitVectList[0])().getNumBits();
+    RDKit::FingerprintArena arena(nBits);
+    arena.reserve(nrows);
+    for(unsigned int i=0;i<nrows;++i){
+      arena.addFingerprint(python::extract<ExplicitBitVect>(bitVectList[i])());
+    }
+    calcTanimotoMetricMatrix(arena,res,returnDistance,numThreads);
+  }
   
   PyObject *getEuclideanDistMat(python::object descripMat) {
     // Bit of a pain involved here, we accept three types of PyObjects here
@@ -166,7 +177,7 @@ namespace RDDataManip {
     return PyArray_Return(distRes);
   }
   
-  PyObject *getTanimotoDistMat(python::object bitVectList) {
+  PyObject *getTanimotoDistMat(python::object bitVectList,int numThreads) {
     // we will assume here that we have a either a list of ExplicitBitVectors or
     // SparseBitVects
     int nrows = python::extract<int>(bitVectList.attr("__len__")());
@@ -185,10 +196,7 @@ namespace RDDataManip {
     double *sMat = (double *)simRes->data;
     
     if (ebvWorks.check()) {
-      PySequenceHolder<ExplicitBitVect> dData(bitVectList);
-      MetricMatrixCalc<PySequenceHolder<ExplicitBitVect>, ExplicitBitVect> mmCalc;
-      mmCalc.setMetricFunc(&TanimotoDistanceMetric<ExplicitBitVect, ExplicitBitVect>);
-      mmCalc.calcMetricMatrix(dData, nrows, 0, sMat);
+      getTanimotoMatFromEBVs(bitVectList,nrows,sMat,true,numThreads);
     }
     else if (sbvWorks.check()) {
       PySequenceHolder<SparseBitVect> dData(bitVectList);
@@ -199,7 +207,7 @@ namespace RDDataManip {
     return PyArray_Return(simRes);
   }
 
-  PyObject *getTanimotoSimMat(python::object bitVectList) {
+  PyObject *getTanimotoSimMat(python::object bitVectList,int numThreads) {
     // we will assume here that we have a either a list of ExplicitBitVectors or
     // SparseBitVects
     int nrows = python::extract<int>(bitVectList.attr("__len__")());
@@ -218,10 +226,7 @@ namespace RDDataManip {
     double *sMat = (double *)simRes->data;
     
     if (ebvWorks.check()) {
-      PySequenceHolder<ExplicitBitVect> dData(bitVectList);
-      MetricMatrixCalc<PySequenceHolder<ExplicitBitVect>, ExplicitBitVect> mmCalc;
-      mmCalc.setMetricFunc(&TanimotoSimilarityMetric<ExplicitBitVect, ExplicitBitVect>);
-      mmCalc.calcMetricMatrix(dData, nrows, 0, sMat);
+      getTanimotoMatFromEBVs(bitVectList,nrows,sMat,false,numThreads);
     }
     else if (sbvWorks.check()) {
       PySequenceHolder<SparseBitVect> dData(bitVectList);
@@ -264,20 +269,24 @@ BOOST_PYTHON_MODULE(rdMetricMatrixCalc)
   ARGUMENTS: \n\
 \n\
     bitVectList - a list of bit vectors. Currently this works only for a list of explicit bit vectors, \n\
-                  needs to be expanded to support a list of SparseBitVects\n\n\
+                  needs to be expanded to support a list of SparseBitVects\n\
+    numThreads - (optional) the number of threads to use for lists of ExplicitBitVects\n\n\
   RETURNS: \n\
     A numeric 1 dimensional array containing the lower triangle elements of the\n\
     symmetric distance matrix\n\n";
   python::def("GetTanimotoDistMat", RDDataManip::getTanimotoDistMat,
+              (python::arg("bitVectList"),python::arg("numThreads")=1),
               docString.c_str());
   
   docString = "Compute the similarity matrix from a list of BitVects \n\n\
   ARGUMENTS: \n\
 \n\
     bitVectList - a list of bit vectors. Currently this works only for a list of explicit bit vectors, \n\
-                  needs to be expanded to support a list of SparseBitVects\n\n\
+                  needs to be expanded to support a list of SparseBitVects\n\
+    numThreads - (optional) the number of threads to use for lists of ExplicitBitVects\n\n\
   RETURNS: \n\
     A numeric 1 dimensional array containing the lower triangle elements of the symmetric similarity matrix\n\n";
   python::def("GetTanimotoSimMat", RDDataManip::getTanimotoSimMat,
+              (python::arg("bitVectList"),python::arg("numThreads")=1),
               docString.c_str());
 }
@@ -132,6 +132,16 @@ class TestCase(unittest.TestCase):
 
         for i in range(n*(n-1)/2) :
             assert feq(sMat[i] + dMat[i], 1.0) 
+
+        k = 0
+        for i in range(1,n):
+            for j in range(i):
+                assert feq(sMat[k],DataStructs.TanimotoSimilarity(lst[i],lst[j]))
+                k += 1
+
+        dMat2 = rdmmc.GetTanimotoDistMat(lst,numThreads=4)
+        for i in range(n*(n-1)/2) :
+            assert feq(dMat2[i], dMat[i]) 
                         
     def test5sbv(self) :
 
@@ -10,12 +10,120 @@
 //
 #include "MetricFuncs.h"
 #include "MetricMatrixCalc.h"
+#include "BlockedMetricMatrixCalc.h"
+#include <RDGeneral/Invariant.h>
+#include <DataStructs/BitVects.h>
 
 #include <cstdlib>
 #include <time.h>
+#include <vector>
 
 using namespace RDDataManip;
+
+// collects the blocks passed back by the streaming functions
+template <typename T>
+struct BlockCollector {
+  std::vector<T> vals;
+  unsigned int nextRow;
+  BlockCollector() : nextRow(1) {};
+  void operator()(unsigned int firstRow,unsigned int lastRow,const T *blockVals){
+    TEST_ASSERT(firstRow==nextRow);
+    TEST_ASSERT(lastRow>firstRow);
+    nextRow=lastRow;
+    size_t nVals=detail::triangleRowStart(lastRow)-detail::triangleRowStart(firstRow);
+    vals.insert(vals.end(),blockVals,blockVals+nVals);
+  }
+};
+
+void testBlockedEuclidean(){
+  const unsigned int n=203,m=7;
+  std::vector<double> desc(n*m);
+  std::vector<double *> desc2D(n);
+  for(unsigned int i=0;i<n;++i){
+    desc2D[i]=&desc[i*m];
+    for(unsigned int j=0;j<m;++j){
+      desc[i*m+j]=((double)rand())/RAND_MAX;
+    }
+  }
+  const unsigned int dlen=n*(n-1)/2;
+  std::vector<double> ref(dlen);
+  MetricMatrixCalc<std::vector<double *>, double*> mmCalc;
+  mmCalc.setMetricFunc(&EuclideanDistanceMetric<double *, double *>);
+  mmCalc.calcMetricMatrix(desc2D, n, m, &ref[0]);
+
+  for(int nThreads=1;nThreads<=3;++nThreads){
+    for(unsigned int blockSize=1;blockSize<=64;blockSize*=8){
+      std::vector<double> dmat(dlen,-1);
+      calcEuclideanMetricMatrix(&desc[0],n,m,&dmat[0],nThreads,blockSize);
+      for(unsigned int i=0;i<dlen;++i){
+        TEST_ASSERT(dmat[i]==ref[i]);
+      }
+    }
+  }
+  std::vector<float> fmat(dlen);
+  calcEuclideanMetricMatrix(&desc[0],n,m,&fmat[0],2);
+  for(unsigned int i=0;i<dlen;++i){
+    TEST_ASSERT(fmat[i]==static_cast<float>(ref[i]));
+  }
+
+  BlockCollector<float> collector;
+  streamEuclideanMetricMatrix<float>(&desc[0],n,m,collector,37,2);
+  TEST_ASSERT(collector.nextRow==n);
+  TEST_ASSERT(collector.vals==fmat);
+}
+
+void testBlockedTanimoto(){
+  const unsigned int n=150,nBits=1024;
+  std::vector<ExplicitBitVect *> fps;
+  std::vector<const ExplicitBitVect *> cfps;
+  for(unsigned int i=0;i<n;++i){
+    ExplicitBitVect *fp=new ExplicitBitVect(nBits);
+    unsigned int nOn=rand()%200;
+    for(unsigned int j=0;j<nOn;++j) fp->setBit(rand()%nBits);
+    fps.push_back(fp);
+    cfps.push_back(fp);
+  }
+  const unsigned int dlen=n*(n-1)/2;
+  std::vector<double> ref(dlen),refSim(dlen);
+  for(unsigned int i=1;i<n;++i){
+    for(unsigned int j=0;j<i;++j){
+      refSim[i*(i-1)/2+j]=TanimotoSimilarity(*fps[i],*fps[j]);
+      ref[i*(i-1)/2+j]=1.0-refSim[i*(i-1)/2+j];
+    }
+  }
+
+  for(int nThreads=1;nThreads<=4;nThreads+=3){
+    std::vector<double> dmat(dlen,-1);
+    calcTanimotoMetricMatrix(cfps,&dmat[0],true,nThreads,16);
+    for(unsigned int i=0;i<dlen;++i){
+      TEST_ASSERT(dmat[i]==ref[i]);
+    }
+    calcTanimotoMetricMatrix(cfps,&dmat[0],false,nThreads);
+    for(unsigned int i=0;i<dlen;++i){
+      TEST_ASSERT(dmat[i]==refSim[i]);
+    }
+  }
+
+  RDKit::FingerprintArena arena(nBits);
+  for(unsigned int i=0;i<n;++i) arena.addFingerprint(*fps[i]);
+  std::vector<float> fmat(dlen);
+  calcTanimotoMetricMatrix(arena,&fmat[0]);
+  for(unsigned int i=0;i<dlen;++i){
+    TEST_ASSERT(fmat[i]==static_cast<float>(ref[i]));
+  }
+  BlockCollector<float> collector;
+  streamTanimotoMetricMatrix<float>(arena,collector,n);
+  TEST_ASSERT(collector.vals==fmat);
+  BlockCollector<double> dcollector;
+  streamTanimotoMetricMatrix<double>(arena,dcollector,10,true,3);
+  TEST_ASSERT(dcollector.vals==ref);
+
+  for(unsigned int i=0;i<n;++i) delete fps[i];
+}
+
 int main() {
+  testBlockedEuclidean();
+  testBlockedTanimoto();
   
   int n = 10;
   int m = 3;
@@ -8,11 +8,14 @@
 //  which is included in the file license.txt, found at the root
 //  of the RDKit source tree.
 //
+
 #include <RDBoost/Exceptions.h>
 #include "BitVects.h"
 #include "BitOps.h"
+#include "BitmapOps.h"
 #include <math.h>
 #include <string>
+#include <vector>
 #include <iostream>
 #include <RDGeneral/StreamOps.h>
 #include <RDGeneral/types.h>
@@ -23,6 +26,39 @@
 
 using namespace RDKit;
 
+namespace {
+  // a copy of the blocks of an ExplicitBitVect, made with the public
+  // boost::to_block_range(). Fingerprints of up to 8192 bits are copied
+  // to the stack, so the common cases don't allocate.
+  class BlockCopy {
+  public:
+    typedef boost::dynamic_bitset<>::block_type block_type;
+    explicit BlockCopy(const ExplicitBitVect &bv) :
+      d_nBlocks(static_cast<unsigned int>(bv.dp_bits->num_blocks())) {
+      if(d_nBlocks<=maxStackBlocks){
+        dp_blocks=d_stackBlocks;
+      } else {
+        d_heapBlocks.resize(d_nBlocks);
+        dp_blocks=&d_heapBlocks[0];
+      }
+      boost::to_block_range(*bv.dp_bits,dp_blocks);
+    };
+    const block_type *getBlocks() const { return dp_blocks; };
+    const unsigned char *getBitmap() const {
+      return reinterpret_cast<const unsigned char *>(dp_blocks);
+    };
+    unsigned int getBitmapSize() const {
+      return d_nBlocks*sizeof(block_type);
+    };
+  private:
+    static const unsigned int maxStackBlocks=8192/(8*sizeof(block_type));
+    unsigned int d_nBlocks;
+    block_type d_stackBlocks[maxStackBlocks];
+    std::vector<block_type> d_heapBlocks;
+    block_type *dp_blocks;
+  };
+}
+
 int getBitId(const char *&text,int format,int size,int curr){
   PRECONDITION(text,"no text");
   int res=-1;
@@ -199,7 +235,45 @@ int
 NumOnBitsInCommon(const ExplicitBitVect& bv1,
                   const ExplicitBitVect& bv2)
 {
-  return ((*bv1.dp_bits) & (*bv2.dp_bits)).count();
+  if(bv1.getNumBits()!=bv2.getNumBits())
+    throw ValueErrorException("BitVects must be same length");
+  BlockCopy bm1(bv1),bm2(bv2);
+  return CalcBitmapNumBitsInCommon(bm1.getBitmap(),bm2.getBitmap(),
+                                   bm1.getBitmapSize());
+}
+
+namespace {
+  // collects the counts the similarity metrics need:
+  //   x=(bv1&bv2)_o, y=(bv1)_o, z=(bv2)_o
+  template <typename T1, typename T2>
+  void getBitCounts(const T1& bv1,const T2& bv2,
+                    double &x,double &y,double &z){
+    x = NumOnBitsInCommon(bv1,bv2);
+    y = bv1.getNumOnBits();
+    z = bv2.getNumOnBits();
+  }
+  // an ExplicitBitVect keeps track of its number of on bits, so only
+  // the intersection needs a pass over the blocks
+  void getBitCounts(const ExplicitBitVect& bv1,const ExplicitBitVect& bv2,
+                    double &x,double &y,double &z){
+    BlockCopy bm1(bv1),bm2(bv2);
+    x = CalcBitmapNumBitsInCommon(bm1.getBitmap(),bm2.getBitmap(),
+                                  bm1.getBitmapSize());
+    y = bv1.getNumOnBits();
+    z = bv2.getNumOnBits();
+  }
+
+  // returns (bv1|bv2)_o
+  template <typename T1, typename T2>
+  unsigned int numOnBitsInUnion(const T1& bv1,const T2& bv2){
+    return (bv1|bv2).getNumOnBits();
+  }
+  unsigned int numOnBitsInUnion(const ExplicitBitVect& bv1,
+                                const ExplicitBitVect& bv2){
+    double x,y,z;
+    getBitCounts(bv1,bv2,x,y,z);
+    return static_cast<unsigned int>(y+z-x);
+  }
 }
 
 
@@ -225,9 +299,8 @@ TanimotoSimilarity(const T1& bv1,
 {
   if(bv1.getNumBits()!=bv2.getNumBits())
     throw ValueErrorException("BitVects must be same length");
-  double x = NumOnBitsInCommon(bv1,bv2);
-  double y = bv1.getNumOnBits();
-  double z = bv2.getNumOnBits();
+  double x,y,z;
+  getBitCounts(bv1,bv2,x,y,z);
   if((y+z-x)==0.0) return 1.0;
   else return x / (y+z-x);
 }
@@ -244,9 +317,8 @@ TverskySimilarity(const T1& bv1,
   RANGE_CHECK(0,b,1);
   if(bv1.getNumBits()!=bv2.getNumBits())
     throw ValueErrorException("BitVects must be same length");
-  double x = NumOnBitsInCommon(bv1,bv2);
-  double y = bv1.getNumOnBits();
-  double z = bv2.getNumOnBits();
+  double x,y,z;
+  getBitCounts(bv1,bv2,x,y,z);
   double denom = a*y + b*z + (1-a-b)*x;
   if(denom==0.0) return 1.0;
   else return x / denom;
@@ -259,9 +331,8 @@ CosineSimilarity(const T1& bv1,
 {
   if(bv1.getNumBits()!=bv2.getNumBits())
     throw ValueErrorException("BitVects must be same length");
-  double x = NumOnBitsInCommon(bv1,bv2);
-  double y = bv1.getNumOnBits();
-  double z = bv2.getNumOnBits();
+  double x,y,z;
+  getBitCounts(bv1,bv2,x,y,z);
 
   if(y*z>0.0){
     return x / sqrt(y*z);
@@ -277,9 +348,8 @@ KulczynskiSimilarity(const T1& bv1,
 {
   if(bv1.getNumBits()!=bv2.getNumBits())
     throw ValueErrorException("BitVects must be same length");
-  double x = NumOnBitsInCommon(bv1,bv2);
-  double y = bv1.getNumOnBits();
-  double z = bv2.getNumOnBits();
+  double x,y,z;
+  getBitCounts(bv1,bv2,x,y,z);
 
   if(y*z>0.0){
     return x*(y+z)/(2*y*z);
@@ -296,9 +366,8 @@ DiceSimilarity(const T1& bv1,
 {
   if(bv1.getNumBits()!=bv2.getNumBits())
     throw ValueErrorException("BitVects must be same length");
-  double x = NumOnBitsInCommon(bv1,bv2);
-  double y = bv1.getNumOnBits();
-  double z = bv2.getNumOnBits();
+  double x,y,z;
+  getBitCounts(bv1,bv2,x,y,z);
 
   if(y+z>0.0){
     return 2*x/(y+z);
@@ -314,9 +383,8 @@ SokalSimilarity(const T1& bv1,
 {
   if(bv1.getNumBits()!=bv2.getNumBits())
     throw ValueErrorException("BitVects must be same length");
-  double x = NumOnBitsInCommon(bv1,bv2);
-  double y = bv1.getNumOnBits();
-  double z = bv2.getNumOnBits();
+  double x,y,z;
+  getBitCounts(bv1,bv2,x,y,z);
 
   return x/(2*y+2*z-3*x);
 }
@@ -328,9 +396,8 @@ McConnaugheySimilarity(const T1& bv1,
 {
   if(bv1.getNumBits()!=bv2.getNumBits())
     throw ValueErrorException("BitVects must be same length");
-  double x = NumOnBitsInCommon(bv1,bv2);
-  double y = bv1.getNumOnBits();
-  double z = bv2.getNumOnBits();
+  double x,y,z;
+  getBitCounts(bv1,bv2,x,y,z);
 
   if(y*z>0.0){
     return (x*(y+z)-(y*z))/(y*z);
@@ -358,9 +425,8 @@ AsymmetricSimilarity(const T1& bv1,
 {
   if(bv1.getNumBits()!=bv2.getNumBits())
     throw ValueErrorException("BitVects must be same length");
-  double x = NumOnBitsInCommon(bv1,bv2);
-  double y = bv1.getNumOnBits();
-  double z = bv2.getNumOnBits();
+  double x,y,z;
+  getBitCounts(bv1,bv2,x,y,z);
   
   if(tmin(y,z)>0){
     return x/tmin(y,z);
@@ -376,9 +442,8 @@ BraunBlanquetSimilarity(const T1& bv1,
 {
   if(bv1.getNumBits()!=bv2.getNumBits())
     throw ValueErrorException("BitVects must be same length");
-  double x = NumOnBitsInCommon(bv1,bv2);
-  double y = bv1.getNumOnBits();
-  double z = bv2.getNumOnBits();
+  double x,y,z;
+  getBitCounts(bv1,bv2,x,y,z);
 
   if(tmax(y,z)>0){
     return x/tmax(y,z);
@@ -404,9 +469,8 @@ RogotGoldbergSimilarity(const T1& bv1,const T2& bv2)
 {
   if(bv1.getNumBits()!=bv2.getNumBits())
     throw ValueErrorException("BitVects must be same length");
-  double x = NumOnBitsInCommon(bv1,bv2);
-  double y = bv1.getNumOnBits();
-  double z = bv2.getNumOnBits();
+  double x,y,z;
+  getBitCounts(bv1,bv2,x,y,z);
   double l = bv1.getNumBits();
   double d = l - y - z + x;
   if ((x == l) || (d == l)) return 1.0;
@@ -434,8 +498,10 @@ OnBitSimilarity(const T1& bv1,
   if(bv1.getNumBits()!=bv2.getNumBits())
     throw ValueErrorException("BitVects must be same length");
 
-  double num = NumOnBitsInCommon(bv1,bv2);
-  double denom=(bv1|bv2).getNumOnBits();
+  double x,y,z;
+  getBitCounts(bv1,bv2,x,y,z);
+  double num = x;
+  double denom = y+z-x;
 
   if(denom>0){
     return num/denom;
@@ -472,7 +538,12 @@ int
 NumBitsInCommon(const ExplicitBitVect& bv1,
                   const ExplicitBitVect& bv2)
 {
-  return bv1.getNumBits() - ((*bv1.dp_bits) ^ (*bv2.dp_bits)).count();
+  if(bv1.getNumBits()!=bv2.getNumBits())
+    throw ValueErrorException("BitVects must be same length");
+  // (bv1^bv2)_o = (bv1|bv2)_o - (bv1&bv2)_o
+  double x,y,z;
+  getBitCounts(bv1,bv2,x,y,z);
+  return bv1.getNumBits() - static_cast<int>(y+z-2*x);
 }
 
 // """ -------------------------------------------------------
@@ -588,10 +659,11 @@ OnBitProjSimilarity(const T1& bv1,
   if(bv1.getNumBits()!=bv2.getNumBits())
     throw ValueErrorException("BitVects must be same length");
   DoubleVect res(2,0.0);
-  double num=NumOnBitsInCommon(bv1,bv2);
+  double num,y,z;
+  getBitCounts(bv1,bv2,num,y,z);
   if(num){
-    res[0] = num/bv1.getNumOnBits();
-    res[1] = num/bv2.getNumOnBits();
+    res[0] = num/y;
+    res[1] = num/z;
   }
   return res;
 }
@@ -629,7 +701,7 @@ OffBitProjSimilarity(const T1& bv1,
   if(bv1.getNumBits()!=bv2.getNumBits())
     throw ValueErrorException("BitVects must be same length");
   DoubleVect res(2,0.0);
-  double num=(bv1|bv2).getNumOffBits();
+  double num=bv1.getNumBits()-numOnBitsInUnion(bv1,bv2);
   if(num){
     res[0] = num/bv1.getNumOffBits();
     res[1] = num/bv2.getNumOffBits();
@@ -759,6 +831,30 @@ UpdateBitVectFromBinaryText(T1& bv1,const std::string &fps){
   }
 }
 
+void
+BitVectToBitmap(const ExplicitBitVect& bv1,unsigned char *bitmap){
+  PRECONDITION(bitmap,"no bitmap");
+  typedef boost::dynamic_bitset<>::block_type block_type;
+  const unsigned int nBytes=bv1.getNumBits()/8 + (bv1.getNumBits()%8?1:0);
+  BlockCopy copy(bv1);
+  const block_type *blocks=copy.getBlocks();
+  for(unsigned int i=0;i<nBytes;++i){
+    bitmap[i] = static_cast<unsigned char>(blocks[i/sizeof(block_type)] >>
+                                           (8*(i%sizeof(block_type))));
+  }
+}
+
+void
+UpdateBitVectFromBitmap(ExplicitBitVect& bv1,const unsigned char *bitmap){
+  PRECONDITION(bitmap,"no bitmap");
+  const unsigned int nBytes=bv1.getNumBits()/8 + (bv1.getNumBits()%8?1:0);
+  for(unsigned int i=0;i<nBytes;++i){
+    if(!bitmap[i]) continue;
+    for(unsigned int bit=0;bit<8 && 8*i+bit<bv1.getNumBits();++bit){
+      if(bitmap[i]&(1<<bit)) bv1.setBit(8*i+bit);
+    }
+  }
+}
 
 template double TanimotoSimilarity(const SparseBitVect& bv1,const SparseBitVect& bv2);
 template double TverskySimilarity(const SparseBitVect& bv1,const SparseBitVect& bv2,double a, double b);
@@ -330,6 +330,25 @@ template <typename T1>
 void
 UpdateBitVectFromBinaryText(T1& bv1,const std::string &fps);
 
+//! copies the bits of an ExplicitBitVect into a raw bitmap
+/*!
+  \param bv1     the vector to use
+  \param bitmap  the destination, must be at least <tt>(bv1_n+7)/8</tt> bytes long
+
+  The layout of the bitmap is the same as that produced by BitVectToBinaryText()
+  and is what the functions in BitmapOps.h expect.
+ */
+void
+BitVectToBitmap(const ExplicitBitVect& bv1,unsigned char *bitmap);
+
+//! updates an ExplicitBitVect from a raw bitmap
+/*!
+  \param bv1     the vector to update
+  \param bitmap  the source, must be at least <tt>(bv1_n+7)/8</tt> bytes long
+
+ */
+void
+UpdateBitVectFromBitmap(ExplicitBitVect& bv1,const unsigned char *bitmap);
 
 
 #endif
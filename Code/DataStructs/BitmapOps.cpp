@@ -0,0 +1,358 @@
+//
+//  Copyright (C) 2013 Greg Landrum and Rational Discovery LLC
+//
+//  @@ All Rights Reserved @@
+//  This file is part of the RDKit.
+//  The contents are covered by the terms of the BSD license
+//  which is included in the file license.txt, found at the root
+//  of the RDKit source tree.
+//
+#include "BitmapOps.h"
+#include <RDGeneral/Invariant.h>
+#include <RDBoost/Exceptions.h>
+#include <boost/cstdint.hpp>
+#include <cstring>
+
+// runtime selection of the SIMD kernels needs the gcc/clang target
+// attribute and cpu detection builtins
+#if defined(__x86_64__) && \
+  (defined(__clang__) || (defined(__GNUC__) && (__GNUC__>4 || (__GNUC__==4 && __GNUC_MINOR__>=9))))
+#define RDK_BITMAP_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__)
+#define RDK_BITMAP_INLINE inline __attribute__((always_inline))
+#else
+#define RDK_BITMAP_INLINE inline
+#endif
+
+namespace {
+  typedef boost::uint64_t WordType;
+  const unsigned int WORD_BYTES=sizeof(WordType);
+
+  RDK_BITMAP_INLINE WordType loadWord(const unsigned char *bv){
+    WordType res;
+    memcpy(&res,bv,WORD_BYTES);
+    return res;
+  }
+  // loads the last, partial word of a bitmap, padding with zeros
+  RDK_BITMAP_INLINE WordType loadTail(const unsigned char *bv,unsigned int nBytes){
+    WordType res=0;
+    memcpy(&res,bv,nBytes);
+    return res;
+  }
+
+  struct PortablePopcount {
+    static RDK_BITMAP_INLINE unsigned int count(WordType x){
+      x = x - ((x >> 1) & 0x5555555555555555ULL);
+      x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+      x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+      return static_cast<unsigned int>((x * 0x0101010101010101ULL) >> 56);
+    }
+  };
+#ifdef RDK_BITMAP_X86_DISPATCH
+  // only used inside functions compiled for the popcnt target, where
+  // the builtin becomes a single instruction
+  struct HardwarePopcount {
+    static RDK_BITMAP_INLINE unsigned int count(WordType x){
+      return static_cast<unsigned int>(__builtin_popcountll(x));
+    }
+  };
+#endif
+
+  // -------------------------------------------------
+  // word-at-a-time loops, parameterized on the popcount
+  template <typename PC>
+  RDK_BITMAP_INLINE unsigned int wordPopcount(const unsigned char *bv1,
+                                              unsigned int nBytes){
+    unsigned int res=0;
+    unsigned int i=0;
+    for(;i+WORD_BYTES<=nBytes;i+=WORD_BYTES){
+      res += PC::count(loadWord(bv1+i));
+    }
+    if(i<nBytes){
+      res += PC::count(loadTail(bv1+i,nBytes-i));
+    }
+    return res;
+  }
+  template <typename PC>
+  RDK_BITMAP_INLINE unsigned int wordNumBitsInCommon(const unsigned char *bv1,
+                                                     const unsigned char *bv2,
+                                                     unsigned int nBytes){
+    unsigned int res=0;
+    unsigned int i=0;
+    for(;i+WORD_BYTES<=nBytes;i+=WORD_BYTES){
+      res += PC::count(loadWord(bv1+i)&loadWord(bv2+i));
+    }
+    if(i<nBytes){
+      res += PC::count(loadTail(bv1+i,nBytes-i)&loadTail(bv2+i,nBytes-i));
+    }
+    return res;
+  }
+  template <typename PC>
+  RDK_BITMAP_INLINE void wordBitCounts(const unsigned char *bv1,
+                                       const unsigned char *bv2,
+                                       unsigned int nBytes,
+                                       unsigned int &nOn1,unsigned int &nOn2,
+                                       unsigned int &nCommon){
+    unsigned int i=0;
+    for(;i+WORD_BYTES<=nBytes;i+=WORD_BYTES){
+      WordType w1=loadWord(bv1+i);
+      WordType w2=loadWord(bv2+i);
+      nOn1 += PC::count(w1);
+      nOn2 += PC::count(w2);
+      nCommon += PC::count(w1&w2);
+    }
+    if(i<nBytes){
+      WordType w1=loadTail(bv1+i,nBytes-i);
+      WordType w2=loadTail(bv2+i,nBytes-i);
+      nOn1 += PC::count(w1);
+      nOn2 += PC::count(w2);
+      nCommon += PC::count(w1&w2);
+    }
+  }
+
+  // -------------------------------------------------
+  // portable implementations
+  unsigned int popcountPortable(const unsigned char *bv1,unsigned int nBytes){
+    return wordPopcount<PortablePopcount>(bv1,nBytes);
+  }
+  unsigned int numBitsInCommonPortable(const unsigned char *bv1,
+                                       const unsigned char *bv2,
+                                       unsigned int nBytes){
+    return wordNumBitsInCommon<PortablePopcount>(bv1,bv2,nBytes);
+  }
+  void bitCountsPortable(const unsigned char *bv1,const unsigned char *bv2,
+                         unsigned int nBytes,unsigned int &nOn1,
+                         unsigned int &nOn2,unsigned int &nCommon){
+    wordBitCounts<PortablePopcount>(bv1,bv2,nBytes,nOn1,nOn2,nCommon);
+  }
+
+#ifdef RDK_BITMAP_X86_DISPATCH
+  // -------------------------------------------------
+  // POPCNT implementations
+  __attribute__((target("popcnt")))
+  unsigned int popcountPopcnt(const unsigned char *bv1,unsigned int nBytes){
+    return wordPopcount<HardwarePopcount>(bv1,nBytes);
+  }
+  __attribute__((target("popcnt")))
+  unsigned int numBitsInCommonPopcnt(const unsigned char *bv1,
+                                     const unsigned char *bv2,
+                                     unsigned int nBytes){
+    return wordNumBitsInCommon<HardwarePopcount>(bv1,bv2,nBytes);
+  }
+  __attribute__((target("popcnt")))
+  void bitCountsPopcnt(const unsigned char *bv1,const unsigned char *bv2,
+                       unsigned int nBytes,unsigned int &nOn1,
+                       unsigned int &nOn2,unsigned int &nCommon){
+    wordBitCounts<HardwarePopcount>(bv1,bv2,nBytes,nOn1,nOn2,nCommon);
+  }
+
+  // -------------------------------------------------
+  // AVX2 implementations
+  //
+  // 32 bytes at a time using Wojciech Mula's nibble lookup-table
+  // popcount (http://0x80.pl/articles/sse-popcount.html).
+  // Whatever is left over is handled by the POPCNT word loop.
+  const unsigned int AVX_BYTES=32;
+
+  __attribute__((target("avx2"))) RDK_BITMAP_INLINE
+  __m256i avxByteCounts(__m256i v){
+    const __m256i lookup=_mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,
+                                          0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+    const __m256i lowMask=_mm256_set1_epi8(0x0f);
+    __m256i lo=_mm256_and_si256(v,lowMask);
+    __m256i hi=_mm256_and_si256(_mm256_srli_epi16(v,4),lowMask);
+    return _mm256_add_epi8(_mm256_shuffle_epi8(lookup,lo),
+                           _mm256_shuffle_epi8(lookup,hi));
+  }
+  // the byte counts of up to 31 vectors can be summed before they
+  // overflow, only then are they widened into the 64 bit lanes
+  const unsigned int AVX_BLOCK=31;
+  __attribute__((target("avx2"))) RDK_BITMAP_INLINE
+  __m256i avxWiden(__m256i acc,__m256i byteCounts){
+    return _mm256_add_epi64(acc,_mm256_sad_epu8(byteCounts,
+                                                _mm256_setzero_si256()));
+  }
+  __attribute__((target("avx2"))) RDK_BITMAP_INLINE
+  unsigned int avxHorizontalSum(__m256i acc){
+    return static_cast<unsigned int>(_mm256_extract_epi64(acc,0)+
+                                     _mm256_extract_epi64(acc,1)+
+                                     _mm256_extract_epi64(acc,2)+
+                                     _mm256_extract_epi64(acc,3));
+  }
+  __attribute__((target("avx2"))) RDK_BITMAP_INLINE
+  __m256i avxLoad(const unsigned char *bv){
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(bv));
+  }
+
+  __attribute__((target("avx2,popcnt")))
+  unsigned int popcountAVX2(const unsigned char *bv1,unsigned int nBytes){
+    __m256i acc=_mm256_setzero_si256();
+    unsigned int i=0;
+    while(i+AVX_BYTES<=nBytes){
+      __m256i bytes=_mm256_setzero_si256();
+      for(unsigned int j=0;j<AVX_BLOCK && i+AVX_BYTES<=nBytes;
+          ++j,i+=AVX_BYTES){
+        bytes=_mm256_add_epi8(bytes,avxByteCounts(avxLoad(bv1+i)));
+      }
+      acc=avxWiden(acc,bytes);
+    }
+    return avxHorizontalSum(acc)+
+      wordPopcount<HardwarePopcount>(bv1+i,nBytes-i);
+  }
+  __attribute__((target("avx2,popcnt")))
+  unsigned int numBitsInCommonAVX2(const unsigned char *bv1,
+                                   const unsigned char *bv2,
+                                   unsigned int nBytes){
+    __m256i acc=_mm256_setzero_si256();
+    unsigned int i=0;
+    while(i+AVX_BYTES<=nBytes){
+      __m256i bytes=_mm256_setzero_si256();
+      for(unsigned int j=0;j<AVX_BLOCK && i+AVX_BYTES<=nBytes;
+          ++j,i+=AVX_BYTES){
+        __m256i v=_mm256_and_si256(avxLoad(bv1+i),avxLoad(bv2+i));
+        bytes=_mm256_add_epi8(bytes,avxByteCounts(v));
+      }
+      acc=avxWiden(acc,bytes);
+    }
+    return avxHorizontalSum(acc)+
+      wordNumBitsInCommon<HardwarePopcount>(bv1+i,bv2+i,nBytes-i);
+  }
+  __attribute__((target("avx2,popcnt")))
+  void bitCountsAVX2(const unsigned char *bv1,const unsigned char *bv2,
+                     unsigned int nBytes,unsigned int &nOn1,
+                     unsigned int &nOn2,unsigned int &nCommon){
+    __m256i acc1=_mm256_setzero_si256();
+    __m256i acc2=_mm256_setzero_si256();
+    __m256i accCommon=_mm256_setzero_si256();
+    unsigned int i=0;
+    while(i+AVX_BYTES<=nBytes){
+      __m256i bytes1=_mm256_setzero_si256();
+      __m256i bytes2=_mm256_setzero_si256();
+      __m256i bytesCommon=_mm256_setzero_si256();
+      for(unsigned int j=0;j<AVX_BLOCK && i+AVX_BYTES<=nBytes;
+          ++j,i+=AVX_BYTES){
+        __m256i v1=avxLoad(bv1+i);
+        __m256i v2=avxLoad(bv2+i);
+        bytes1=_mm256_add_epi8(bytes1,avxByteCounts(v1));
+        bytes2=_mm256_add_epi8(bytes2,avxByteCounts(v2));
+        bytesCommon=_mm256_add_epi8(bytesCommon,
+                                    avxByteCounts(_mm256_and_si256(v1,v2)));
+      }
+      acc1=avxWiden(acc1,bytes1);
+      acc2=avxWiden(acc2,bytes2);
+      accCommon=avxWiden(accCommon,bytesCommon);
+    }
+    nOn1+=avxHorizontalSum(acc1);
+    nOn2+=avxHorizontalSum(acc2);
+    nCommon+=avxHorizontalSum(accCommon);
+    wordBitCounts<HardwarePopcount>(bv1+i,bv2+i,nBytes-i,nOn1,nOn2,nCommon);
+  }
+#endif
+
+  // -------------------------------------------------
+  // runtime dispatch
+  struct BitmapKernels {
+    unsigned int (*popcount)(const unsigned char *,unsigned int);
+    unsigned int (*numBitsInCommon)(const unsigned char *,const unsigned char *,
+                                    unsigned int);
+    void (*bitCounts)(const unsigned char *,const unsigned char *,unsigned int,
+                      unsigned int &,unsigned int &,unsigned int &);
+    const char *name;
+  };
+
+  BitmapKernels selectKernels(){
+    BitmapKernels res;
+    res.popcount=popcountPortable;
+    res.numBitsInCommon=numBitsInCommonPortable;
+    res.bitCounts=bitCountsPortable;
+    res.name="portable";
+#ifdef RDK_BITMAP_X86_DISPATCH
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")){
+      res.popcount=popcountAVX2;
+      res.numBitsInCommon=numBitsInCommonAVX2;
+      res.bitCounts=bitCountsAVX2;
+      res.name="avx2";
+    } else if(__builtin_cpu_supports("popcnt")){
+      res.popcount=popcountPopcnt;
+      res.numBitsInCommon=numBitsInCommonPopcnt;
+      res.bitCounts=bitCountsPopcnt;
+      res.name="popcnt";
+    }
+#endif
+    return res;
+  }
+
+  const BitmapKernels &getKernels(){
+    static const BitmapKernels kernels=selectKernels();
+    return kernels;
+  }
+}
+
+unsigned int CalcBitmapPopcount(const unsigned char *bv1,unsigned int nBytes){
+  PRECONDITION(bv1 || !nBytes,"no bitmap");
+  return getKernels().popcount(bv1,nBytes);
+}
+
+unsigned int CalcBitmapNumBitsInCommon(const unsigned char *bv1,
+                                       const unsigned char *bv2,
+                                       unsigned int nBytes){
+  PRECONDITION((bv1 && bv2) || !nBytes,"no bitmap");
+  return getKernels().numBitsInCommon(bv1,bv2,nBytes);
+}
+
+void CalcBitmapBitCounts(const unsigned char *bv1,const unsigned char *bv2,
+                         unsigned int nBytes,unsigned int &nOn1,
+                         unsigned int &nOn2,unsigned int &nCommon){
+  PRECONDITION((bv1 && bv2) || !nBytes,"no bitmap");
+  nOn1=0;nOn2=0;nCommon=0;
+  getKernels().bitCounts(bv1,bv2,nBytes,nOn1,nOn2,nCommon);
+}
+
+bool CalcBitmapAllProbeBitsMatch(const unsigned char *probe,
+                                 const unsigned char *ref,
+                                 unsigned int nBytes){
+  PRECONDITION((probe && ref) || !nBytes,"no bitmap");
+  unsigned int i=0;
+  for(;i+WORD_BYTES<=nBytes;i+=WORD_BYTES){
+    if(loadWord(probe+i) & ~loadWord(ref+i)) return false;
+  }
+  if(i<nBytes){
+    if(loadTail(probe+i,nBytes-i) & ~loadTail(ref+i,nBytes-i)) return false;
+  }
+  return true;
+}
+
+double CalcBitmapTanimoto(const unsigned char *bv1,const unsigned char *bv2,
+                          unsigned int nBytes){
+  unsigned int y,z,x;
+  CalcBitmapBitCounts(bv1,bv2,nBytes,y,z,x);
+  if(y+z-x==0) return 1.0;
+  return static_cast<double>(x)/(y+z-x);
+}
+
+double CalcBitmapDice(const unsigned char *bv1,const unsigned char *bv2,
+                      unsigned int nBytes){
+  unsigned int y,z,x;
+  CalcBitmapBitCounts(bv1,bv2,nBytes,y,z,x);
+  if(y+z==0) return 0.0;
+  return 2.0*x/(y+z);
+}
+
+double CalcBitmapTversky(const unsigned char *bv1,const unsigned char *bv2,
+                         unsigned int nBytes,double a,double b){
+  RANGE_CHECK(0,a,1);
+  RANGE_CHECK(0,b,1);
+  unsigned int y,z,x;
+  CalcBitmapBitCounts(bv1,bv2,nBytes,y,z,x);
+  double denom = a*y + b*z + (1-a-b)*x;
+  if(denom==0.0) return 1.0;
+  return x/denom;
+}
+
+std::string GetBitmapPopcountImplementation(){
+  return getKernels().name;
+}
@@ -0,0 +1,74 @@
+//
+//  Copyright (C) 2013 Greg Landrum and Rational Discovery LLC
+//
+//  @@ All Rights Reserved @@
+//  This file is part of the RDKit.
+//  The contents are covered by the terms of the BSD license
+//  which is included in the file license.txt, found at the root
+//  of the RDKit source tree.
+//
+#ifndef __RD_BITMAPOPS_H__
+#define __RD_BITMAPOPS_H__
+/*! \file BitmapOps.h
+
+  \brief Popcount kernels operating on raw, packed bitmaps.
+
+  These are the low-level routines used by the ExplicitBitVect
+  similarity functions in BitOps.h. They operate directly on the
+  packed storage of a fingerprint and never allocate.
+
+  On x86-64 builds with gcc or clang the fastest available
+  implementation (AVX2, POPCNT, or portable) is selected at runtime
+  the first time one of the functions is called.
+
+  The two bitmaps passed to a function must have the same length and
+  any padding bits past the end of the fingerprint must be zero.
+*/
+
+#include <string>
+
+//! returns the number of set bits in a bitmap
+unsigned int CalcBitmapPopcount(const unsigned char *bv1,unsigned int nBytes);
+
+//! returns the number of bits set in both of two bitmaps
+unsigned int CalcBitmapNumBitsInCommon(const unsigned char *bv1,
+                                       const unsigned char *bv2,
+                                       unsigned int nBytes);
+
+//! collects all the counts needed for a similarity calculation in one pass
+/*!
+  \param bv1      the first bitmap
+  \param bv2      the second bitmap
+  \param nBytes   the number of bytes in each bitmap
+  \param nOn1     used to return the number of bits set in \c bv1
+  \param nOn2     used to return the number of bits set in \c bv2
+  \param nCommon  used to return the number of bits set in both
+
+  The size of the union is <tt>nOn1+nOn2-nCommon</tt>.
+*/
+void CalcBitmapBitCounts(const unsigned char *bv1,const unsigned char *bv2,
+                         unsigned int nBytes,unsigned int &nOn1,
+                         unsigned int &nOn2,unsigned int &nCommon);
+
+//! returns true if every bit set in \c probe is also set in \c ref
+bool CalcBitmapAllProbeBitsMatch(const unsigned char *probe,
+                                 const unsigned char *ref,
+                                 unsigned int nBytes);
+
+//! returns the Tanimoto similarity between two bitmaps
+double CalcBitmapTanimoto(const unsigned char *bv1,const unsigned char *bv2,
+                          unsigned int nBytes);
+//! returns the Dice similarity between two bitmaps
+double CalcBitmapDice(const unsigned char *bv1,const unsigned char *bv2,
+                      unsigned int nBytes);
+//! returns the Tversky similarity between two bitmaps
+double CalcBitmapTversky(const unsigned char *bv1,const unsigned char *bv2,
+                         unsigned int nBytes,double a,double b);
+
+//! returns the name of the popcount implementation in use
+/*!
+  one of \c "avx2", \c "popcnt" or \c "portable"
+*/
+std::string GetBitmapPopcountImplementation();
+
+#endif
@@ -52,7 +52,7 @@ public:
   void getOnBits (IntVect& v) const;
 
   // FIX: complete these
-  void clearBits() { dp_bits->reset(); };
+  void clearBits() { dp_bits->reset(); d_numOnBits=0; };
   std::string toString() const;
   
   boost::dynamic_bitset<> *dp_bits; //!< our raw storage
@@ -0,0 +1,218 @@
+//
+//  Copyright (C) 2013 Greg Landrum and Rational Discovery LLC
+//
+//  @@ All Rights Reserved @@
+//  This file is part of the RDKit.
+//  The contents are covered by the terms of the BSD license
+//  which is included in the file license.txt, found at the root
+//  of the RDKit source tree.
+//
+#include "FingerprintArena.h"
+#include "BitOps.h"
+#include "BitmapOps.h"
+#include <RDGeneral/Invariant.h>
+#include <RDBoost/Exceptions.h>
+#include <cstring>
+
+namespace RDKit {
+  FingerprintArena::FingerprintArena(unsigned int numBits) :
+    d_numBits(numBits) {
+    d_numBytes = numBits/8 + (numBits%8?1:0);
+    d_numWords = d_numBytes/sizeof(boost::uint64_t) +
+      (d_numBytes%sizeof(boost::uint64_t)?1:0);
+  }
+
+  unsigned char *FingerprintArena::getRecord(unsigned int idx){
+    return reinterpret_cast<unsigned char *>(&d_data[static_cast<size_t>(idx)*d_numWords]);
+  }
+
+  size_t FingerprintArena::getDataSize(unsigned int nFps) const {
+    // the number of words can exceed what an unsigned int (or, on 32 bit
+    // platforms, a size_t) can hold:
+    if(d_numWords && nFps>d_data.max_size()/d_numWords){
+      throw ValueErrorException("too many fingerprints for the arena");
+    }
+    return static_cast<size_t>(nFps)*d_numWords;
+  }
+
+  const unsigned char *FingerprintArena::getBitmap(unsigned int idx) const {
+    if(idx>=size()) throw IndexErrorException(idx);
+    if(!d_numWords) return 0;
+    return reinterpret_cast<const unsigned char *>(&d_data[static_cast<size_t>(idx)*d_numWords]);
+  }
+
+  unsigned int FingerprintArena::getPopcount(unsigned int idx) const {
+    if(idx>=size()) throw IndexErrorException(idx);
+    return d_popcounts[idx];
+  }
+
+  ExplicitBitVect *FingerprintArena::getFingerprint(unsigned int idx) const {
+    const unsigned char *bitmap=getBitmap(idx);
+    ExplicitBitVect *res=new ExplicitBitVect(d_numBits);
+    if(bitmap) UpdateBitVectFromBitmap(*res,bitmap);
+    return res;
+  }
+
+  void FingerprintArena::setFingerprint(unsigned int idx,const unsigned char *bitmap){
+    PRECONDITION(bitmap || !d_numBytes,"no bitmap");
+    if(idx>=size()) throw IndexErrorException(idx);
+    if(!d_numWords) return;
+    unsigned char *rec=getRecord(idx);
+    memcpy(rec,bitmap,d_numBytes);
+    if(d_numBits%8){
+      // make sure we don't pick up stray bits past the end of the fingerprint:
+      rec[d_numBytes-1] &= static_cast<unsigned char>((1<<(d_numBits%8))-1);
+    }
+    d_popcounts[idx]=CalcBitmapPopcount(rec,getStride());
+  }
+
+  void FingerprintArena::setFingerprint(unsigned int idx,const ExplicitBitVect &fp){
+    if(fp.getNumBits()!=d_numBits){
+      throw ValueErrorException("fingerprint size does not match the arena");
+    }
+    if(idx>=size()) throw IndexErrorException(idx);
+    if(!d_numWords) return;
+    unsigned char *rec=getRecord(idx);
+    BitVectToBitmap(fp,rec);
+    d_popcounts[idx]=fp.getNumOnBits();
+  }
+
+  unsigned int FingerprintArena::addFingerprint(const unsigned char *bitmap){
+    unsigned int idx=size();
+    resize(idx+1);
+    setFingerprint(idx,bitmap);
+    return idx;
+  }
+
+  unsigned int FingerprintArena::addFingerprint(const ExplicitBitVect &fp){
+    if(fp.getNumBits()!=d_numBits){
+      throw ValueErrorException("fingerprint size does not match the arena");
+    }
+    unsigned int idx=size();
+    resize(idx+1);
+    setFingerprint(idx,fp);
+    return idx;
+  }
+
+  void FingerprintArena::resize(unsigned int nFps){
+    d_data.resize(getDataSize(nFps),0);
+    d_popcounts.resize(nFps,0);
+  }
+
+  void FingerprintArena::reserve(unsigned int nFps){
+    d_data.reserve(getDataSize(nFps));
+    d_popcounts.reserve(nFps);
+  }
+
+  void FingerprintArena::clear(){
+    d_data.clear();
+    d_popcounts.clear();
+  }
+
+  namespace {
+    // all of the bulk calculations only need the number of bits in
+    // common, the popcounts are already known
+    template <typename T>
+    void bulkSimilarity(const unsigned char *query,unsigned int queryCount,
+                        const FingerprintArena &arena,const T &metric,
+                        double *res,bool returnDistance){
+      PRECONDITION(res || !arena.size(),"no result array");
+      if(!arena.size()) return;
+      const unsigned int stride=arena.getStride();
+      const unsigned char *target=arena.getBitmap(0);
+      for(unsigned int i=0;i<arena.size();++i,target+=stride){
+        unsigned int nCommon=CalcBitmapNumBitsInCommon(query,target,stride);
+        double sim=metric(queryCount,arena.getPopcount(i),nCommon);
+        res[i] = returnDistance ? 1.0-sim : sim;
+      }
+    }
+
+    // the arena records are padded, so the query has to be too:
+    void getPaddedQuery(const ExplicitBitVect &query,
+                        const FingerprintArena &arena,
+                        std::vector<boost::uint64_t> &buffer){
+      if(query.getNumBits()!=arena.getNumBits()){
+        throw ValueErrorException("query size does not match the arena");
+      }
+      buffer.resize(arena.getStride()/sizeof(boost::uint64_t)+1,0);
+      BitVectToBitmap(query,reinterpret_cast<unsigned char *>(&buffer[0]));
+    }
+    const unsigned char *asBytes(const std::vector<boost::uint64_t> &buffer){
+      return reinterpret_cast<const unsigned char *>(&buffer[0]);
+    }
+
+    struct TanimotoFunctor {
+      double operator()(unsigned int y,unsigned int z,unsigned int x) const {
+        if(y+z-x==0) return 1.0;
+        return static_cast<double>(x)/(y+z-x);
+      }
+    };
+    struct DiceFunctor {
+      double operator()(unsigned int y,unsigned int z,unsigned int x) const {
+        if(y+z==0) return 0.0;
+        return 2.0*x/(y+z);
+      }
+    };
+    struct TverskyFunctor {
+      double d_a,d_b;
+      TverskyFunctor(double a,double b) : d_a(a), d_b(b) {
+        RANGE_CHECK(0,a,1);
+        RANGE_CHECK(0,b,1);
+      }
+      double operator()(unsigned int y,unsigned int z,unsigned int x) const {
+        double denom = d_a*y + d_b*z + (1-d_a-d_b)*x;
+        if(denom==0.0) return 1.0;
+        return x/denom;
+      }
+    };
+  }
+
+  void BulkTanimotoSimilarity(const unsigned char *query,
+                              const FingerprintArena &arena,
+                              double *res,bool returnDistance){
+    PRECONDITION(query || !arena.getStride(),"no query");
+    bulkSimilarity(query,CalcBitmapPopcount(query,arena.getStride()),
+                   arena,TanimotoFunctor(),res,returnDistance);
+  }
+  void BulkDiceSimilarity(const unsigned char *query,
+                          const FingerprintArena &arena,
+                          double *res,bool returnDistance){
+    PRECONDITION(query || !arena.getStride(),"no query");
+    bulkSimilarity(query,CalcBitmapPopcount(query,arena.getStride()),
+                   arena,DiceFunctor(),res,returnDistance);
+  }
+  void BulkTverskySimilarity(const unsigned char *query,
+                             const FingerprintArena &arena,
+                             double a,double b,
+                             double *res,bool returnDistance){
+    PRECONDITION(query || !arena.getStride(),"no query");
+    bulkSimilarity(query,CalcBitmapPopcount(query,arena.getStride()),
+                   arena,TverskyFunctor(a,b),res,returnDistance);
+  }
+
+  void BulkTanimotoSimilarity(const ExplicitBitVect &query,
+                              const FingerprintArena &arena,
+                              double *res,bool returnDistance){
+    std::vector<boost::uint64_t> buffer;
+    getPaddedQuery(query,arena,buffer);
+    bulkSimilarity(asBytes(buffer),query.getNumOnBits(),
+                   arena,TanimotoFunctor(),res,returnDistance);
+  }
+  void BulkDiceSimilarity(const ExplicitBitVect &query,
+                          const FingerprintArena &arena,
+                          double *res,bool returnDistance){
+    std::vector<boost::uint64_t> buffer;
+    getPaddedQuery(query,arena,buffer);
+    bulkSimilarity(asBytes(buffer),query.getNumOnBits(),
+                   arena,DiceFunctor(),res,returnDistance);
+  }
+  void BulkTverskySimilarity(const ExplicitBitVect &query,
+                             const FingerprintArena &arena,
+                             double a,double b,
+                             double *res,bool returnDistance){
+    std::vector<boost::uint64_t> buffer;
+    getPaddedQuery(query,arena,buffer);
+    bulkSimilarity(asBytes(buffer),query.getNumOnBits(),
+                   arena,TverskyFunctor(a,b),res,returnDistance);
+  }
+}
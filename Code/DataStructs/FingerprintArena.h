@@ -0,0 +1,184 @@
+//
+//  Copyright (C) 2013 Greg Landrum and Rational Discovery LLC
+//
+//  @@ All Rights Reserved @@
+//  This file is part of the RDKit.
+//  The contents are covered by the terms of the BSD license
+//  which is included in the file license.txt, found at the root
+//  of the RDKit source tree.
+//
+#ifndef __RD_FINGERPRINTARENA_H__
+#define __RD_FINGERPRINTARENA_H__
+/*! \file FingerprintArena.h
+
+  \brief Contiguous storage for sets of same-sized bit vector fingerprints.
+
+*/
+
+#include <vector>
+#include <new>
+#include <cstddef>
+#include <boost/cstdint.hpp>
+#include "ExplicitBitVect.h"
+
+namespace RDKit {
+  //! a packed, contiguous block of fixed-width fingerprints
+  /*!
+    The fingerprints are stored one after the other in a single
+    buffer as raw bitmaps (see BitVectToBitmap()) together with their
+    popcounts. This avoids the per-fingerprint allocations and pointer
+    chasing of a std::vector<ExplicitBitVect *> and is what the bulk
+    similarity functions below operate on.
+
+    Each record is padded to a multiple of 8 bytes; the padding is
+    always zero. The buffer starts on a 64-byte (cache line) boundary,
+    so when the stride is a multiple of 64 bytes (512, 1024, 2048 bits,
+    ...) every record is cache line aligned.
+  */
+  class FingerprintArena {
+  public:
+    //! construct an empty arena for fingerprints with \c numBits bits
+    explicit FingerprintArena(unsigned int numBits);
+
+    //! adds a fingerprint to the end of the arena, returns its index
+    unsigned int addFingerprint(const ExplicitBitVect &fp);
+    //! \overload
+    /*!
+      \c bitmap must be at least getNumBytes() long
+    */
+    unsigned int addFingerprint(const unsigned char *bitmap);
+
+    //! replaces the fingerprint at position \c idx
+    /*!
+      Different threads may safely set different positions of an arena
+      which has already been sized with resize().
+    */
+    void setFingerprint(unsigned int idx,const ExplicitBitVect &fp);
+    //! \overload
+    void setFingerprint(unsigned int idx,const unsigned char *bitmap);
+
+    //! changes the number of fingerprints, new entries are all zero
+    /*!
+      throws a ValueErrorException if the storage for \c nFps
+      fingerprints can't be addressed
+    */
+    void resize(unsigned int nFps);
+    //! reserves space for at least \c nFps fingerprints
+    void reserve(unsigned int nFps);
+    //! removes all fingerprints
+    void clear();
+
+    //! returns the number of fingerprints in the arena
+    unsigned int size() const { return d_popcounts.size(); };
+    //! returns the number of bits in each fingerprint
+    unsigned int getNumBits() const { return d_numBits; };
+    //! returns the number of bytes needed for each fingerprint's bitmap
+    unsigned int getNumBytes() const { return d_numBytes; };
+    //! returns the (padded) number of bytes in each record
+    unsigned int getStride() const { return d_numWords*sizeof(boost::uint64_t); };
+
+    //! returns a pointer to the bitmap of a fingerprint
+    /*!
+      The bitmap is getStride() bytes long and remains valid until the
+      arena is next resized.
+    */
+    const unsigned char *getBitmap(unsigned int idx) const;
+    //! returns the number of bits set in a fingerprint
+    unsigned int getPopcount(unsigned int idx) const;
+    //! returns a copy of a fingerprint, the caller is responsible for deleting it
+    ExplicitBitVect *getFingerprint(unsigned int idx) const;
+
+  private:
+    // an allocator which returns storage aligned to \c Align bytes
+    // (Align must be a power of two). The pointer returned by operator
+    // new is saved just before the aligned block.
+    template <typename T,std::size_t Align>
+    class AlignedAllocator {
+    public:
+      typedef T value_type;
+      typedef T *pointer;
+      typedef const T *const_pointer;
+      typedef T &reference;
+      typedef const T &const_reference;
+      typedef std::size_t size_type;
+      typedef std::ptrdiff_t difference_type;
+      template <typename U> struct rebind { typedef AlignedAllocator<U,Align> other; };
+
+      AlignedAllocator() {};
+      template <typename U> AlignedAllocator(const AlignedAllocator<U,Align> &) {};
+
+      pointer address(reference x) const { return &x; };
+      const_pointer address(const_reference x) const { return &x; };
+      size_type max_size() const {
+        return (static_cast<size_type>(-1)-Align-sizeof(void *))/sizeof(T);
+      };
+      pointer allocate(size_type n,const void * =0){
+        if(n>max_size()) throw std::bad_alloc();
+        char *raw=static_cast<char *>(::operator new(n*sizeof(T)+Align+sizeof(void *)));
+        std::size_t addr=reinterpret_cast<std::size_t>(raw+sizeof(void *));
+        char *aligned=raw+sizeof(void *)+((Align-addr%Align)%Align);
+        reinterpret_cast<void **>(aligned)[-1]=raw;
+        return reinterpret_cast<pointer>(aligned);
+      };
+      void deallocate(pointer p,size_type){
+        if(p) ::operator delete(reinterpret_cast<void **>(p)[-1]);
+      };
+      void construct(pointer p,const T &val){ new(static_cast<void *>(p)) T(val); };
+      void destroy(pointer p){ p->~T(); };
+
+      bool operator==(const AlignedAllocator &) const { return true; };
+      bool operator!=(const AlignedAllocator &) const { return false; };
+    };
+
+    unsigned int d_numBits;
+    unsigned int d_numBytes;
+    unsigned int d_numWords;
+    std::vector<boost::uint64_t,AlignedAllocator<boost::uint64_t,64> > d_data;
+    std::vector<unsigned int> d_popcounts;
+
+    unsigned char *getRecord(unsigned int idx);
+    size_t getDataSize(unsigned int nFps) const;
+  };
+
+  //! \name Bulk similarity calculations
+  /*!
+    Each of these computes the similarity between a query and every
+    fingerprint in an arena. The results are written to \c res, which
+    must have room for <tt>arena.size()</tt> values.
+
+    The query must have the same number of bits as the arena's
+    fingerprints.
+  */
+  //@{
+  void BulkTanimotoSimilarity(const ExplicitBitVect &query,
+                              const FingerprintArena &arena,
+                              double *res,bool returnDistance=false);
+  void BulkDiceSimilarity(const ExplicitBitVect &query,
+                          const FingerprintArena &arena,
+                          double *res,bool returnDistance=false);
+  void BulkTverskySimilarity(const ExplicitBitVect &query,
+                             const FingerprintArena &arena,
+                             double a,double b,
+                             double *res,bool returnDistance=false);
+
+  //! \overload
+  /*!
+    The query is a bitmap which is at least <tt>arena.getStride()</tt>
+    bytes long with zero padding (e.g. one from another arena).
+  */
+  void BulkTanimotoSimilarity(const unsigned char *query,
+                              const FingerprintArena &arena,
+                              double *res,bool returnDistance=false);
+  //! \overload
+  void BulkDiceSimilarity(const unsigned char *query,
+                          const FingerprintArena &arena,
+                          double *res,bool returnDistance=false);
+  //! \overload
+  void BulkTverskySimilarity(const unsigned char *query,
+                             const FingerprintArena &arena,
+                             double a,double b,
+                             double *res,bool returnDistance=false);
+  //@}
+}
+
+#endif
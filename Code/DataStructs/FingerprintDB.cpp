@@ -0,0 +1,286 @@
+//
+//  Copyright (C) 2013 Greg Landrum and Rational Discovery LLC
+//
+//  @@ All Rights Reserved @@
+//  This file is part of the RDKit.
+//  The contents are covered by the terms of the BSD license
+//  which is included in the file license.txt, found at the root
+//  of the RDKit source tree.
+//
+#include "FingerprintDB.h"
+#include "BitOps.h"
+#include <RDGeneral/Invariant.h>
+#include <RDBoost/Exceptions.h>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/lexical_cast.hpp>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+namespace RDKit {
+  namespace {
+    const char FPDB_MAGIC[8]={'R','D','F','P','D','B','\0','\0'};
+    const boost::uint32_t FPDB_VERSION=1;
+    const boost::uint32_t FPDB_BYTEORDER=0x01020304;
+    const boost::uint64_t FPDB_ALIGNMENT=64;
+
+    struct FPDBHeader {
+      char magic[8];
+      boost::uint32_t version;
+      boost::uint32_t byteOrder;
+      boost::uint32_t numBits;
+      boost::uint32_t stride;
+      boost::uint64_t numRecords;
+      boost::uint64_t binStartsOffset;
+      boost::uint64_t recordsOffset;
+      boost::uint64_t idOffsetsOffset;
+      boost::uint64_t idDataOffset;
+    };
+
+    boost::uint64_t alignOffset(boost::uint64_t offset,boost::uint64_t alignment){
+      return (offset+alignment-1)/alignment*alignment;
+    }
+
+    void writePadding(std::ostream &os,boost::uint64_t from,boost::uint64_t to){
+      for(;from<to;++from) os.put('\0');
+    }
+
+    // the offsets come from the file, so the arithmetic on them has to
+    // be checked. These return false if the result does not fit.
+    bool checkedAdd(boost::uint64_t a,boost::uint64_t b,boost::uint64_t &res){
+      if(a>std::numeric_limits<boost::uint64_t>::max()-b) return false;
+      res=a+b;
+      return true;
+    }
+    bool checkedMul(boost::uint64_t a,boost::uint64_t b,boost::uint64_t &res){
+      if(a && b>std::numeric_limits<boost::uint64_t>::max()/a) return false;
+      res=a*b;
+      return true;
+    }
+    // checks that the section [offset,offset+count*width) starts on a
+    // multiple of alignment and ends at or before end
+    bool sectionFits(boost::uint64_t offset,boost::uint64_t count,boost::uint64_t width,
+                     boost::uint64_t alignment,boost::uint64_t end){
+      boost::uint64_t size,sectionEnd;
+      return !(offset%alignment) &&
+        checkedMul(count,width,size) &&
+        checkedAdd(offset,size,sectionEnd) &&
+        sectionEnd<=end;
+    }
+    // checks that vals[0]==0, that vals never decreases and that
+    // vals[count-1]<=maxVal
+    template <typename T>
+    bool offsetsAreValid(const T *vals,boost::uint64_t count,boost::uint64_t maxVal){
+      if(vals[0]) return false;
+      for(boost::uint64_t i=1;i<count;++i){
+        if(vals[i]<vals[i-1]) return false;
+      }
+      return vals[count-1]<=maxVal;
+    }
+  }
+
+  void WriteFingerprintDB(const FingerprintArena &fps,
+                          const std::vector<std::string> &ids,
+                          const std::string &fileName){
+    // FingerprintArena::size() is an unsigned int, so the number of
+    // records always fits the limit FingerprintDB checks for.
+    if(!ids.empty() && ids.size()!=fps.size()){
+      throw ValueErrorException("number of ids does not match the number of fingerprints");
+    }
+    // the TanimotoSearchIndex does the sorting for us:
+    TanimotoSearchIndex index(fps);
+    detail::SortedFingerprintView view=index.getView();
+    const boost::uint64_t numRecords=fps.size();
+
+    FPDBHeader header;
+    memset(static_cast<void *>(&header),0,sizeof(header));
+    memcpy(header.magic,FPDB_MAGIC,sizeof(FPDB_MAGIC));
+    header.version=FPDB_VERSION;
+    header.byteOrder=FPDB_BYTEORDER;
+    header.numBits=fps.getNumBits();
+    header.stride=fps.getStride();
+    header.numRecords=numRecords;
+    header.binStartsOffset=sizeof(FPDBHeader);
+    header.recordsOffset=alignOffset(header.binStartsOffset+
+                                     (header.numBits+2)*sizeof(boost::uint32_t),
+                                     FPDB_ALIGNMENT);
+    header.idOffsetsOffset=header.recordsOffset+numRecords*header.stride;
+    header.idDataOffset=header.idOffsetsOffset+(numRecords+1)*sizeof(boost::uint64_t);
+
+    std::vector<std::string> sortedIds(numRecords);
+    std::vector<boost::uint64_t> idOffsets(numRecords+1,0);
+    for(boost::uint64_t i=0;i<numRecords;++i){
+      if(ids.empty()){
+        sortedIds[i]=boost::lexical_cast<std::string>(view.ids[i]);
+      } else {
+        sortedIds[i]=ids[view.ids[i]];
+      }
+      idOffsets[i+1]=idOffsets[i]+sortedIds[i].size();
+    }
+
+    std::ofstream outs(fileName.c_str(),std::ios_base::binary);
+    if(!outs || outs.bad()){
+      throw ValueErrorException("could not open file "+fileName+" for writing");
+    }
+    outs.write(reinterpret_cast<const char *>(&header),sizeof(header));
+    outs.write(reinterpret_cast<const char *>(view.binStarts),
+               (header.numBits+2)*sizeof(boost::uint32_t));
+    writePadding(outs,header.binStartsOffset+(header.numBits+2)*sizeof(boost::uint32_t),
+                 header.recordsOffset);
+    if(numRecords && header.stride){
+      outs.write(reinterpret_cast<const char *>(view.bitmaps),numRecords*header.stride);
+    }
+    outs.write(reinterpret_cast<const char *>(&idOffsets[0]),
+               idOffsets.size()*sizeof(boost::uint64_t));
+    for(boost::uint64_t i=0;i<numRecords;++i){
+      outs.write(sortedIds[i].c_str(),sortedIds[i].size());
+    }
+    if(outs.bad()){
+      throw ValueErrorException("error writing file "+fileName);
+    }
+  }
+
+  FingerprintDB::FingerprintDB(const std::string &fileName){
+    using namespace boost::interprocess;
+    try {
+      dp_file.reset(new file_mapping(fileName.c_str(),read_only));
+      dp_region.reset(new mapped_region(*dp_file,read_only));
+    } catch (interprocess_exception &) {
+      throw ValueErrorException("could not map file "+fileName);
+    }
+    const unsigned char *base=static_cast<const unsigned char *>(dp_region->get_address());
+    const boost::uint64_t fileSize=dp_region->get_size();
+
+    if(fileSize<sizeof(FPDBHeader)){
+      throw ValueErrorException("file "+fileName+" is too short to be a fingerprint database");
+    }
+    FPDBHeader header;
+    memcpy(static_cast<void *>(&header),base,sizeof(header));
+    if(memcmp(header.magic,FPDB_MAGIC,sizeof(FPDB_MAGIC))){
+      throw ValueErrorException("file "+fileName+" is not a fingerprint database");
+    }
+    if(header.byteOrder!=FPDB_BYTEORDER){
+      throw ValueErrorException("fingerprint database "+fileName+" has the wrong byte order");
+    }
+    if(header.version!=FPDB_VERSION){
+      throw ValueErrorException("fingerprint database "+fileName+" has an unsupported version");
+    }
+    // the record indices are unsigned ints:
+    if(header.numRecords>std::numeric_limits<unsigned int>::max()){
+      throw ValueErrorException("fingerprint database "+fileName+" has too many records");
+    }
+    const boost::uint64_t numBins=static_cast<boost::uint64_t>(header.numBits)+2;
+    const boost::uint64_t numIdOffsets=header.numRecords+1;
+    if(header.stride%sizeof(boost::uint64_t) ||
+       static_cast<boost::uint64_t>(header.stride)*8<header.numBits ||
+       header.binStartsOffset<sizeof(FPDBHeader) ||
+       !sectionFits(header.binStartsOffset,numBins,sizeof(boost::uint32_t),
+                    sizeof(boost::uint32_t),header.recordsOffset) ||
+       !sectionFits(header.recordsOffset,header.numRecords,header.stride,
+                    FPDB_ALIGNMENT,header.idOffsetsOffset) ||
+       !sectionFits(header.idOffsetsOffset,numIdOffsets,sizeof(boost::uint64_t),
+                    sizeof(boost::uint64_t),header.idDataOffset) ||
+       header.idDataOffset>fileSize){
+      throw ValueErrorException("fingerprint database "+fileName+" is corrupt");
+    }
+
+    d_numBits=header.numBits;
+    d_stride=header.stride;
+    d_numRecords=static_cast<unsigned int>(header.numRecords);
+    dp_binStarts=reinterpret_cast<const boost::uint32_t *>(base+header.binStartsOffset);
+    dp_records=base+header.recordsOffset;
+    dp_idOffsets=reinterpret_cast<const boost::uint64_t *>(base+header.idOffsetsOffset);
+    dp_idData=reinterpret_cast<const char *>(base+header.idDataOffset);
+    d_idDataSize=fileSize-header.idDataOffset;
+    // the searches index the records with the popcount bins without
+    // further checks. There are only numBits+2 of them, so they are all
+    // checked here; the id offsets are checked by getId(), otherwise
+    // opening the file would touch every page of the id table.
+    if(!offsetsAreValid(dp_binStarts,numBins,d_numRecords) ||
+       dp_binStarts[numBins-1]!=d_numRecords ||
+       dp_idOffsets[0] || dp_idOffsets[numIdOffsets-1]>d_idDataSize){
+      throw ValueErrorException("fingerprint database "+fileName+" is corrupt");
+    }
+  }
+
+  FingerprintDB::~FingerprintDB(){
+  }
+
+  const unsigned char *FingerprintDB::getBitmap(unsigned int idx) const {
+    if(idx>=size()) throw IndexErrorException(idx);
+    return dp_records+static_cast<size_t>(idx)*d_stride;
+  }
+
+  unsigned int FingerprintDB::getPopcount(unsigned int idx) const {
+    if(idx>=size()) throw IndexErrorException(idx);
+    // the records are sorted by popcount, so find the bin this one is in:
+    const boost::uint32_t *bin=std::upper_bound(dp_binStarts,dp_binStarts+d_numBits+2,idx);
+    return bin-dp_binStarts-1;
+  }
+
+  std::string FingerprintDB::getId(unsigned int idx) const {
+    if(idx>=size()) throw IndexErrorException(idx);
+    const boost::uint64_t start=dp_idOffsets[idx],end=dp_idOffsets[idx+1];
+    if(start>end || end>d_idDataSize){
+      throw ValueErrorException("fingerprint database has a corrupt id table");
+    }
+    return std::string(dp_idData+start,dp_idData+end);
+  }
+
+  ExplicitBitVect *FingerprintDB::getFingerprint(unsigned int idx) const {
+    const unsigned char *bitmap=getBitmap(idx);
+    ExplicitBitVect *res=new ExplicitBitVect(d_numBits);
+    if(d_numBits) UpdateBitVectFromBitmap(*res,bitmap);
+    return res;
+  }
+
+  std::pair<unsigned int,unsigned int>
+  FingerprintDB::getPopcountRange(unsigned int popcount) const {
+    if(popcount>d_numBits) return std::make_pair(d_numRecords,d_numRecords);
+    return std::make_pair(dp_binStarts[popcount],dp_binStarts[popcount+1]);
+  }
+
+  detail::SortedFingerprintView FingerprintDB::getView() const {
+    detail::SortedFingerprintView res;
+    res.bitmaps=dp_records;
+    res.stride=d_stride;
+    res.numBits=d_numBits;
+    res.binStarts=dp_binStarts;
+    res.ids=0;
+    return res;
+  }
+
+  void FingerprintDB::getPaddedQuery(const ExplicitBitVect &query,
+                                     std::vector<boost::uint64_t> &buffer) const {
+    if(query.getNumBits()!=d_numBits){
+      throw ValueErrorException("query size does not match the database");
+    }
+    buffer.resize(d_stride/sizeof(boost::uint64_t)+1,0);
+    BitVectToBitmap(query,reinterpret_cast<unsigned char *>(&buffer[0]));
+  }
+
+  SimilarityHitVect FingerprintDB::thresholdSearch(const ExplicitBitVect &query,
+                                                   double threshold) const {
+    std::vector<boost::uint64_t> buffer;
+    getPaddedQuery(query,buffer);
+    SimilarityHitVect res;
+    detail::thresholdSearch(getView(),
+                            reinterpret_cast<const unsigned char *>(&buffer[0]),
+                            query.getNumOnBits(),threshold,res);
+    return res;
+  }
+
+  SimilarityHitVect FingerprintDB::topKSearch(const ExplicitBitVect &query,
+                                              unsigned int k,
+                                              double threshold) const {
+    std::vector<boost::uint64_t> buffer;
+    getPaddedQuery(query,buffer);
+    SimilarityHitVect res;
+    detail::topKSearch(getView(),
+                       reinterpret_cast<const unsigned char *>(&buffer[0]),
+                       query.getNumOnBits(),k,threshold,res);
+    return res;
+  }
+}
@@ -0,0 +1,145 @@
+//
+//  Copyright (C) 2013 Greg Landrum and Rational Discovery LLC
+//
+//  @@ All Rights Reserved @@
+//  This file is part of the RDKit.
+//  The contents are covered by the terms of the BSD license
+//  which is included in the file license.txt, found at the root
+//  of the RDKit source tree.
+//
+#ifndef __RD_FINGERPRINTDB_H__
+#define __RD_FINGERPRINTDB_H__
+/*! \file FingerprintDB.h
+
+  \brief A binary fingerprint file format which can be used via mmap.
+
+  The file layout is (all integers are in the byte order of the
+  machine which wrote the file, offsets are from the start of the
+  file):
+
+    - a 64 byte header: the magic string \c "RDFPDB", the format
+      version, a byte order marker, the number of bits in the
+      fingerprints, the record stride, the number of records and the
+      offsets of the sections below.
+    - the popcount bins: <tt>numBits+2</tt> uint32s, entry \c i is the
+      position of the first record with \c i bits set.
+    - the records: fixed-width, zero padded bitmaps (see
+      BitVectToBitmap()) sorted by popcount. This section starts on a
+      64 byte boundary and the stride is a multiple of 8 bytes.
+    - the id table: <tt>numRecords+1</tt> uint64 offsets into the id
+      data, followed by the id data itself.
+
+*/
+
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/scoped_ptr.hpp>
+#include "ExplicitBitVect.h"
+#include "FingerprintArena.h"
+#include "SimilaritySearch.h"
+
+namespace boost {
+  namespace interprocess {
+    class file_mapping;
+    class mapped_region;
+  }
+}
+
+namespace RDKit {
+  //! writes the fingerprints in an arena to a fingerprint database file
+  /*!
+    \param fps       the fingerprints
+    \param ids       the id of each fingerprint. If this is empty the
+                     position of each fingerprint in the arena is used
+                     as its id.
+    \param fileName  the name of the file to create
+
+    The records in the file are sorted by popcount, so they will
+    generally not be in the same order as in the arena.
+  */
+  void WriteFingerprintDB(const FingerprintArena &fps,
+                          const std::vector<std::string> &ids,
+                          const std::string &fileName);
+
+  //! read-only access to a fingerprint database file
+  /*!
+    The file is memory-mapped rather than read, so opening even a very
+    large database is fast and processes which open the same file
+    share a single copy of it in the page cache.
+
+    The bitmaps returned by getBitmap() point directly into the
+    mapping; they are getStride() bytes long and zero padded, so they
+    can be passed to the CalcBitmap*() functions or used as queries
+    for the bulk similarity functions. They are valid for the lifetime
+    of the FingerprintDB.
+
+    The database is immutable, so it can be searched from any number
+    of threads at once.
+  */
+  class FingerprintDB {
+  public:
+    //! opens a database, throws a ValueErrorException if the file is not valid
+    /*!
+      The header and the popcount bins are checked when the file is
+      opened; the id offsets of a record are only checked when getId()
+      is called, so opening does not depend on the number of records.
+      Files with more than UINT_MAX records are rejected.
+    */
+    explicit FingerprintDB(const std::string &fileName);
+    ~FingerprintDB();
+
+    //! returns the number of fingerprints in the database
+    unsigned int size() const { return d_numRecords; };
+    //! returns the number of bits in each fingerprint
+    unsigned int getNumBits() const { return d_numBits; };
+    //! returns the number of bytes in each record
+    unsigned int getStride() const { return d_stride; };
+
+    //! returns a pointer to the bitmap of a record
+    const unsigned char *getBitmap(unsigned int idx) const;
+    //! returns the number of bits set in a record
+    unsigned int getPopcount(unsigned int idx) const;
+    //! returns the id of a record, throws a ValueErrorException if its id offsets are not valid
+    std::string getId(unsigned int idx) const;
+    //! returns a copy of a record's fingerprint, the caller is responsible for deleting it
+    ExplicitBitVect *getFingerprint(unsigned int idx) const;
+
+    //! returns the range [first,last) of records with \c popcount bits set
+    std::pair<unsigned int,unsigned int> getPopcountRange(unsigned int popcount) const;
+
+    //! \name searches
+    /*!
+      These behave like the equivalent methods of TanimotoSearchIndex;
+      the indices in the results are record positions in the database.
+    */
+    //@{
+    SimilarityHitVect thresholdSearch(const ExplicitBitVect &query,
+                                      double threshold) const;
+    SimilarityHitVect topKSearch(const ExplicitBitVect &query,unsigned int k,
+                                 double threshold=0.0) const;
+    //@}
+
+  private:
+    // disable copies, the mapping is not shareable
+    FingerprintDB(const FingerprintDB &);
+    FingerprintDB &operator=(const FingerprintDB &);
+
+    boost::scoped_ptr<boost::interprocess::file_mapping> dp_file;
+    boost::scoped_ptr<boost::interprocess::mapped_region> dp_region;
+    unsigned int d_numBits;
+    unsigned int d_stride;
+    unsigned int d_numRecords;
+    const boost::uint32_t *dp_binStarts;
+    const unsigned char *dp_records;
+    const boost::uint64_t *dp_idOffsets;
+    const char *dp_idData;
+    boost::uint64_t d_idDataSize;
+
+    detail::SortedFingerprintView getView() const;
+    void getPaddedQuery(const ExplicitBitVect &query,
+                        std::vector<boost::uint64_t> &buffer) const;
+  };
+}
+
+#endif
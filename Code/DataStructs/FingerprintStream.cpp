@@ -0,0 +1,205 @@
+//
+//  Copyright (C) 2013 Greg Landrum and Rational Discovery LLC
+//
+//  @@ All Rights Reserved @@
+//  This file is part of the RDKit.
+//  The contents are covered by the terms of the BSD license
+//  which is included in the file license.txt, found at the root
+//  of the RDKit source tree.
+//
+#include "FingerprintStream.h"
+#include "BitOps.h"
+#include <RDGeneral/Invariant.h>
+#include <RDBoost/Exceptions.h>
+#include <cstring>
+
+namespace RDKit {
+  namespace {
+    const char FPST_MAGIC[8]={'R','D','F','P','S','T','\0','\0'};
+    const boost::uint32_t FPST_VERSION=1;
+    const boost::uint32_t FPST_BYTEORDER=0x01020304;
+
+    struct FPSTHeader {
+      char magic[8];
+      boost::uint32_t version;
+      boost::uint32_t byteOrder;
+      boost::uint32_t numBits;
+      boost::uint32_t fpType;
+      boost::uint64_t numRecords;
+      boost::uint64_t dataEnd;
+      boost::uint64_t nextInputIdx;
+      boost::uint64_t fpParams;
+      boost::uint64_t unused;
+    };
+
+    // reads and checks the header, returns the size of the file
+    boost::uint64_t readHeader(std::istream &ins,const std::string &fileName,
+                               FPSTHeader &header){
+      ins.seekg(0,std::ios_base::end);
+      boost::uint64_t fileSize=ins.tellg();
+      ins.seekg(0,std::ios_base::beg);
+      if(fileSize<sizeof(FPSTHeader)){
+        throw ValueErrorException("file "+fileName+" is too short to be a fingerprint stream");
+      }
+      ins.read(reinterpret_cast<char *>(&header),sizeof(header));
+      if(memcmp(header.magic,FPST_MAGIC,sizeof(FPST_MAGIC))){
+        throw ValueErrorException("file "+fileName+" is not a fingerprint stream");
+      }
+      if(header.byteOrder!=FPST_BYTEORDER){
+        throw ValueErrorException("fingerprint stream "+fileName+" has the wrong byte order");
+      }
+      if(header.version!=FPST_VERSION){
+        throw ValueErrorException("fingerprint stream "+fileName+" has an unsupported version");
+      }
+      if(header.dataEnd<sizeof(FPSTHeader) || header.dataEnd>fileSize){
+        throw ValueErrorException("fingerprint stream "+fileName+" is corrupt");
+      }
+      return fileSize;
+    }
+  }
+
+  FingerprintStreamWriter::FingerprintStreamWriter(const std::string &fileName,
+                                                   unsigned int numBits,
+                                                   bool resume,
+                                                   boost::uint32_t fpType,
+                                                   boost::uint64_t fpParams) :
+    d_fileName(fileName), d_numBits(numBits), d_numBytes((numBits+7)/8),
+    d_fpType(fpType), d_fpParams(fpParams),
+    d_numRecords(0), d_dataEnd(sizeof(FPSTHeader)), d_nextInputIdx(0) {
+    if(resume){
+      d_stream.open(fileName.c_str(),
+                    std::ios_base::in|std::ios_base::out|std::ios_base::binary);
+    }
+    if(d_stream.is_open()){
+      FPSTHeader header;
+      readHeader(d_stream,fileName,header);
+      if(header.numBits!=numBits){
+        throw ValueErrorException("fingerprint stream "+fileName+
+                                  " has fingerprints of a different size");
+      }
+      if(header.fpType!=fpType || header.fpParams!=fpParams){
+        throw ValueErrorException("fingerprint stream "+fileName+
+                                  " has fingerprints of a different type");
+      }
+      d_numRecords=header.numRecords;
+      d_dataEnd=header.dataEnd;
+      d_nextInputIdx=header.nextInputIdx;
+      // anything after the last checkpoint is overwritten:
+      d_stream.seekp(d_dataEnd);
+    } else {
+      d_stream.clear();
+      d_stream.open(fileName.c_str(),std::ios_base::in|std::ios_base::out|
+                    std::ios_base::binary|std::ios_base::trunc);
+      if(!d_stream.is_open()){
+        throw ValueErrorException("could not open file "+fileName+" for writing");
+      }
+      writeHeader();
+    }
+    if(d_stream.bad()){
+      throw ValueErrorException("error opening file "+fileName);
+    }
+  }
+
+  void FingerprintStreamWriter::addRecord(boost::uint64_t inputIdx,const std::string &id,
+                                          const unsigned char *bitmap){
+    PRECONDITION(bitmap || !d_numBytes,"no bitmap");
+    const boost::uint32_t idLength=id.size();
+    d_buffer.resize(sizeof(inputIdx)+sizeof(idLength)+idLength+d_numBytes);
+    unsigned char *ptr=&d_buffer[0];
+    memcpy(ptr,&inputIdx,sizeof(inputIdx));
+    ptr+=sizeof(inputIdx);
+    memcpy(ptr,&idLength,sizeof(idLength));
+    ptr+=sizeof(idLength);
+    if(idLength) memcpy(ptr,id.c_str(),idLength);
+    ptr+=idLength;
+    if(d_numBytes) memcpy(ptr,bitmap,d_numBytes);
+    d_stream.write(reinterpret_cast<const char *>(&d_buffer[0]),d_buffer.size());
+    if(d_stream.bad()){
+      throw ValueErrorException("error writing file "+d_fileName);
+    }
+    ++d_numRecords;
+  }
+
+  void FingerprintStreamWriter::addRecord(boost::uint64_t inputIdx,const std::string &id,
+                                          const ExplicitBitVect &fp){
+    if(fp.getNumBits()!=d_numBits){
+      throw ValueErrorException("fingerprint size does not match the stream");
+    }
+    std::vector<unsigned char> bitmap(d_numBytes+1,0);
+    if(d_numBits) BitVectToBitmap(fp,&bitmap[0]);
+    addRecord(inputIdx,id,&bitmap[0]);
+  }
+
+  void FingerprintStreamWriter::checkpoint(boost::uint64_t nextInputIdx){
+    d_stream.flush();
+    d_dataEnd=d_stream.tellp();
+    d_nextInputIdx=nextInputIdx;
+    writeHeader();
+  }
+
+  void FingerprintStreamWriter::writeHeader(){
+    FPSTHeader header;
+    memset(static_cast<void *>(&header),0,sizeof(header));
+    memcpy(header.magic,FPST_MAGIC,sizeof(FPST_MAGIC));
+    header.version=FPST_VERSION;
+    header.byteOrder=FPST_BYTEORDER;
+    header.numBits=d_numBits;
+    header.fpType=d_fpType;
+    header.fpParams=d_fpParams;
+    header.numRecords=d_numRecords;
+    header.dataEnd=d_dataEnd;
+    header.nextInputIdx=d_nextInputIdx;
+    d_stream.seekp(0);
+    d_stream.write(reinterpret_cast<const char *>(&header),sizeof(header));
+    d_stream.flush();
+    d_stream.seekp(d_dataEnd);
+    if(d_stream.bad()){
+      throw ValueErrorException("error writing file "+d_fileName);
+    }
+  }
+
+  boost::uint64_t ReadFingerprintStream(const std::string &fileName,
+                                        FingerprintArena &fps,
+                                        std::vector<std::string> &ids,
+                                        std::vector<boost::uint64_t> *inputIdx){
+    std::ifstream ins(fileName.c_str(),std::ios_base::binary);
+    if(!ins.is_open()){
+      throw ValueErrorException("could not open file "+fileName);
+    }
+    FPSTHeader header;
+    readHeader(ins,fileName,header);
+    if(header.numBits!=fps.getNumBits()){
+      throw ValueErrorException("fingerprint stream "+fileName+
+                                " has fingerprints of a different size");
+    }
+
+    const unsigned int numBytes=(header.numBits+7)/8;
+    // the arena wants padded bitmaps:
+    std::vector<unsigned char> bitmap(fps.getStride()+1,0);
+    boost::uint64_t pos=sizeof(FPSTHeader);
+    for(boost::uint64_t i=0;i<header.numRecords;++i){
+      boost::uint64_t idx;
+      boost::uint32_t idLength;
+      if(pos+sizeof(idx)+sizeof(idLength)>header.dataEnd){
+        throw ValueErrorException("fingerprint stream "+fileName+" is corrupt");
+      }
+      ins.read(reinterpret_cast<char *>(&idx),sizeof(idx));
+      ins.read(reinterpret_cast<char *>(&idLength),sizeof(idLength));
+      pos+=sizeof(idx)+sizeof(idLength);
+      if(pos+idLength+numBytes>header.dataEnd){
+        throw ValueErrorException("fingerprint stream "+fileName+" is corrupt");
+      }
+      std::string id(idLength,' ');
+      if(idLength) ins.read(&id[0],idLength);
+      if(numBytes) ins.read(reinterpret_cast<char *>(&bitmap[0]),numBytes);
+      pos+=idLength+numBytes;
+      if(!ins){
+        throw ValueErrorException("error reading file "+fileName);
+      }
+      fps.addFingerprint(&bitmap[0]);
+      ids.push_back(id);
+      if(inputIdx) inputIdx->push_back(idx);
+    }
+    return header.nextInputIdx;
+  }
+}
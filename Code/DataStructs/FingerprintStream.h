@@ -0,0 +1,154 @@
+//
+//  Copyright (C) 2013 Greg Landrum and Rational Discovery LLC
+//
+//  @@ All Rights Reserved @@
+//  This file is part of the RDKit.
+//  The contents are covered by the terms of the BSD license
+//  which is included in the file license.txt, found at the root
+//  of the RDKit source tree.
+//
+#ifndef __RD_FINGERPRINTSTREAM_H__
+#define __RD_FINGERPRINTSTREAM_H__
+/*! \file FingerprintStream.h
+
+  \brief An append-only binary fingerprint file which is written as
+  fingerprints are calculated.
+
+  Unlike the FingerprintDB format, which is sorted by popcount and
+  has to be written in one go, records are added to a fingerprint
+  stream file in the order they are produced. The file is committed
+  at checkpoints, so a long calculation which is interrupted can be
+  restarted from the last checkpoint.
+
+  The file layout is (all integers are in the byte order of the
+  machine which wrote the file):
+
+    - a 64 byte header: the magic string \c "RDFPST", the format
+      version, a byte order marker, the number of bits in the
+      fingerprints, the fingerprint type, the number of records, the
+      offset of the end of the last record, the checkpoint (the index
+      of the next input record) and the fingerprint parameters.
+    - the records, each of which is: the uint64 index of the input
+      record the fingerprint came from, the uint32 length of the id,
+      the id and the <tt>(numBits+7)/8</tt> byte bitmap (see
+      BitVectToBitmap()).
+
+  Anything after the end of the last record in the header is ignored;
+  it's what was written after the last checkpoint.
+
+*/
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <boost/cstdint.hpp>
+#include "ExplicitBitVect.h"
+#include "FingerprintArena.h"
+
+namespace RDKit {
+  //! writes a fingerprint stream file
+  class FingerprintStreamWriter {
+  public:
+    //! opens a file for writing
+    /*!
+      \param fileName  the name of the file
+      \param numBits   the number of bits in the fingerprints
+      \param resume    if this is set and the file exists, new records
+                       are added after the ones from the file's last
+                       checkpoint. Otherwise the file is created or
+                       overwritten.
+      \param fpType    identifies the kind of fingerprint
+      \param fpParams  identifies the parameters of the fingerprints,
+                       e.g. a hash of them
+
+      \c fpType and \c fpParams are stored in the file and are only
+      used to check that a resumed file has the same fingerprints.
+
+      Throws a ValueErrorException if the file cannot be opened or, when
+      resuming, if it isn't a fingerprint stream file with \c numBits
+      bit fingerprints of the same type and parameters.
+    */
+    FingerprintStreamWriter(const std::string &fileName,unsigned int numBits,
+                            bool resume=false,boost::uint32_t fpType=0,
+                            boost::uint64_t fpParams=0);
+
+    //! adds a record
+    /*!
+      \param inputIdx  the index of the input record (e.g. the molecule)
+                       the fingerprint was calculated from
+      \param id        the id of the record
+      \param bitmap    the fingerprint, <tt>(numBits+7)/8</tt> bytes long
+    */
+    void addRecord(boost::uint64_t inputIdx,const std::string &id,
+                   const unsigned char *bitmap);
+    //! \overload
+    void addRecord(boost::uint64_t inputIdx,const std::string &id,
+                   const ExplicitBitVect &fp);
+
+    //! commits the records added so far
+    /*!
+      \param nextInputIdx  the index of the next input record; this is
+                           where a restarted calculation should begin
+
+      The records added since the previous checkpoint are only part of
+      the file once this has been called.
+
+      <b>Notes:</b>
+        - the records and then the header are flushed to the operating
+          system, there is no fsync(). A checkpoint survives the process
+          being killed, but not necessarily a crash of the machine.
+    */
+    void checkpoint(boost::uint64_t nextInputIdx);
+
+    //! returns the number of bits in the fingerprints
+    unsigned int getNumBits() const { return d_numBits; };
+    //! returns the fingerprint type
+    boost::uint32_t getFingerprintType() const { return d_fpType; };
+    //! returns the fingerprint parameters
+    boost::uint64_t getFingerprintParams() const { return d_fpParams; };
+    //! returns the number of records, including those added since the last checkpoint
+    boost::uint64_t size() const { return d_numRecords; };
+    //! returns the index of the next input record from the last checkpoint
+    boost::uint64_t getNextInputIdx() const { return d_nextInputIdx; };
+
+  private:
+    // disable copies
+    FingerprintStreamWriter(const FingerprintStreamWriter &);
+    FingerprintStreamWriter &operator=(const FingerprintStreamWriter &);
+
+    std::string d_fileName;
+    std::fstream d_stream;
+    unsigned int d_numBits;
+    unsigned int d_numBytes;
+    boost::uint32_t d_fpType;
+    boost::uint64_t d_fpParams;
+    boost::uint64_t d_numRecords;
+    boost::uint64_t d_dataEnd;
+    boost::uint64_t d_nextInputIdx;
+    std::vector<unsigned char> d_buffer;
+
+    void writeHeader();
+  };
+
+  //! reads the records of a fingerprint stream file
+  /*!
+    \param fileName  the name of the file
+    \param fps       the fingerprints are appended to this, it must
+                     have the same number of bits as the file's
+                     fingerprints
+    \param ids       the id of each record is appended to this
+    \param inputIdx  if provided, the index of the input record of each
+                     record is appended to this
+
+    \return the checkpoint of the file: the index of the next input record
+
+    Only the records up to the file's last checkpoint are read.
+    Throws a ValueErrorException if the file is not valid.
+  */
+  boost::uint64_t ReadFingerprintStream(const std::string &fileName,
+                                        FingerprintArena &fps,
+                                        std::vector<std::string> &ids,
+                                        std::vector<boost::uint64_t> *inputIdx=0);
+}
+
+#endif
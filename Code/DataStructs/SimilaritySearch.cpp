@@ -0,0 +1,410 @@
+//
+//  Copyright (C) 2013 Greg Landrum and Rational Discovery LLC
+//
+//  @@ All Rights Reserved @@
+//  This file is part of the RDKit.
+//  The contents are covered by the terms of the BSD license
+//  which is included in the file license.txt, found at the root
+//  of the RDKit source tree.
+//
+#include "SimilaritySearch.h"
+#include "BitOps.h"
+#include "BitmapOps.h"
+#include <RDGeneral/Invariant.h>
+#include <RDGeneral/RDThreads.h>
+#include <RDBoost/Exceptions.h>
+#include <boost/cstdint.hpp>
+#include <algorithm>
+#include <queue>
+#include <cmath>
+
+#ifdef RDK_THREADSAFE_SSS
+#include <boost/thread.hpp>
+#endif
+
+namespace RDKit {
+  namespace {
+    // orders hits from best to worst: decreasing similarity, then increasing index
+    struct HitIsBetter {
+      bool operator()(const SimilarityHit &h1,const SimilarityHit &h2) const {
+        if(h1.first!=h2.first) return h1.first>h2.first;
+        return h1.second<h2.second;
+      }
+    };
+
+    inline double tanimoto(unsigned int a,unsigned int b,unsigned int x){
+      if(a+b-x==0) return 1.0;
+      return static_cast<double>(x)/(a+b-x);
+    }
+
+    // the upper bound on the similarity between a query with a bits set
+    // and a target with b bits set
+    inline double tanimotoBound(unsigned int a,unsigned int b){
+      if(a==b) return 1.0;
+      if(b<a) return static_cast<double>(b)/a;
+      return static_cast<double>(a)/b;
+    }
+
+    void getPaddedQuery(const ExplicitBitVect &query,unsigned int numBits,
+                        unsigned int stride,
+                        std::vector<boost::uint64_t> &buffer){
+      if(query.getNumBits()!=numBits){
+        throw ValueErrorException("query size does not match the index");
+      }
+      buffer.resize(stride/sizeof(boost::uint64_t)+1,0);
+      BitVectToBitmap(query,reinterpret_cast<unsigned char *>(&buffer[0]));
+    }
+
+    const double BOUND_TOL=1e-8;
+  }
+
+  TanimotoSearchIndex::TanimotoSearchIndex(const FingerprintArena &fps) :
+    d_fps(fps.getNumBits()) {
+    const unsigned int numBits=fps.getNumBits();
+
+    // counting sort on popcount:
+    d_binStarts.resize(numBits+2,0);
+    for(unsigned int i=0;i<fps.size();++i){
+      ++d_binStarts[fps.getPopcount(i)+1];
+    }
+    for(unsigned int i=1;i<d_binStarts.size();++i){
+      d_binStarts[i]+=d_binStarts[i-1];
+    }
+    std::vector<boost::uint32_t> nextPos(d_binStarts.begin(),d_binStarts.end()-1);
+    d_ids.resize(fps.size());
+    d_fps.resize(fps.size());
+    for(unsigned int i=0;i<fps.size();++i){
+      boost::uint32_t pos=nextPos[fps.getPopcount(i)]++;
+      d_ids[pos]=i;
+      if(fps.getNumBytes()){
+        d_fps.setFingerprint(pos,fps.getBitmap(i));
+      }
+    }
+  }
+
+  namespace detail {
+    void thresholdSearch(const SortedFingerprintView &view,
+                         const unsigned char *query,unsigned int queryCount,
+                         double threshold,SimilarityHitVect &res){
+      res.clear();
+      const unsigned int numBits=view.numBits;
+      if(view.binStarts[numBits+1]==0) return;
+      unsigned int lo=0,hi=numBits;
+      if(threshold>0){
+        double dlo=std::ceil(threshold*queryCount-BOUND_TOL);
+        double dhi=std::floor(queryCount/threshold+BOUND_TOL);
+        lo = dlo>0 ? static_cast<unsigned int>(dlo) : 0;
+        hi = dhi<numBits ? static_cast<unsigned int>(dhi) : numBits;
+      }
+      for(unsigned int bin=lo;bin<=hi;++bin){
+        for(unsigned int pos=view.binStarts[bin];pos<view.binStarts[bin+1];++pos){
+          unsigned int nCommon=CalcBitmapNumBitsInCommon(query,
+                                                         view.bitmaps+static_cast<size_t>(pos)*view.stride,
+                                                         view.stride);
+          double sim=tanimoto(queryCount,bin,nCommon);
+          if(sim>=threshold){
+            res.push_back(std::make_pair(sim,view.ids ? view.ids[pos] : pos));
+          }
+        }
+      }
+      std::sort(res.begin(),res.end(),HitIsBetter());
+    }
+
+    void topKSearch(const SortedFingerprintView &view,
+                    const unsigned char *query,unsigned int queryCount,
+                    unsigned int k,double threshold,SimilarityHitVect &res){
+      res.clear();
+      const unsigned int numBits=view.numBits;
+      if(view.binStarts[numBits+1]==0 || !k) return;
+
+      // the top of the heap is the worst hit we are keeping
+      std::priority_queue<SimilarityHit,SimilarityHitVect,HitIsBetter> heap;
+
+      // the bins are visited outwards from the query's popcount, always
+      // taking whichever of the two candidate bins has the higher bound
+      int down=std::min(queryCount,numBits);
+      unsigned int up=down+1;
+      while(down>=0 || up<=numBits){
+        unsigned int bin;
+        if(down<0){
+          bin=up++;
+        } else if(up>numBits){
+          bin=down--;
+        } else if(tanimotoBound(queryCount,down)>=tanimotoBound(queryCount,up)){
+          bin=down--;
+        } else {
+          bin=up++;
+        }
+        double bound=tanimotoBound(queryCount,bin);
+        if(bound<threshold) break;
+        if(heap.size()==k && bound<heap.top().first) break;
+
+        for(unsigned int pos=view.binStarts[bin];pos<view.binStarts[bin+1];++pos){
+          unsigned int nCommon=CalcBitmapNumBitsInCommon(query,
+                                                         view.bitmaps+static_cast<size_t>(pos)*view.stride,
+                                                         view.stride);
+          SimilarityHit hit(tanimoto(queryCount,bin,nCommon),
+                            view.ids ? view.ids[pos] : pos);
+          if(hit.first<threshold) continue;
+          if(heap.size()<k){
+            heap.push(hit);
+          } else if(HitIsBetter()(hit,heap.top())){
+            heap.pop();
+            heap.push(hit);
+          }
+        }
+      }
+
+      res.reserve(heap.size());
+      while(!heap.empty()){
+        res.push_back(heap.top());
+        heap.pop();
+      }
+      std::reverse(res.begin(),res.end());
+    }
+  }
+
+  detail::SortedFingerprintView TanimotoSearchIndex::getView() const {
+    detail::SortedFingerprintView res;
+    res.bitmaps = size() ? d_fps.getBitmap(0) : 0;
+    res.stride = d_fps.getStride();
+    res.numBits = getNumBits();
+    res.binStarts = &d_binStarts[0];
+    res.ids = d_ids.empty() ? 0 : &d_ids[0];
+    return res;
+  }
+
+  SimilarityHitVect TanimotoSearchIndex::thresholdSearch(const ExplicitBitVect &query,
+                                                         double threshold) const {
+    std::vector<boost::uint64_t> buffer;
+    getPaddedQuery(query,getNumBits(),d_fps.getStride(),buffer);
+    SimilarityHitVect res;
+    detail::thresholdSearch(getView(),
+                            reinterpret_cast<const unsigned char *>(&buffer[0]),
+                            query.getNumOnBits(),threshold,res);
+    return res;
+  }
+
+  SimilarityHitVect TanimotoSearchIndex::topKSearch(const ExplicitBitVect &query,
+                                                    unsigned int k,
+                                                    double threshold) const {
+    std::vector<boost::uint64_t> buffer;
+    getPaddedQuery(query,getNumBits(),d_fps.getStride(),buffer);
+    SimilarityHitVect res;
+    detail::topKSearch(getView(),
+                       reinterpret_cast<const unsigned char *>(&buffer[0]),
+                       query.getNumOnBits(),k,threshold,res);
+    return res;
+  }
+
+  namespace {
+    void runThresholdSearches(const TanimotoSearchIndex *index,
+                              const std::vector<const ExplicitBitVect *> *queries,
+                              double threshold,
+                              std::vector<SimilarityHitVect> *res,
+                              unsigned int threadIdx,unsigned int numThreads){
+      for(unsigned int i=threadIdx;i<queries->size();i+=numThreads){
+        (*res)[i]=index->thresholdSearch(*(*queries)[i],threshold);
+      }
+    }
+    void runTopKSearches(const TanimotoSearchIndex *index,
+                         const std::vector<const ExplicitBitVect *> *queries,
+                         unsigned int k,double threshold,
+                         std::vector<SimilarityHitVect> *res,
+                         unsigned int threadIdx,unsigned int numThreads){
+      for(unsigned int i=threadIdx;i<queries->size();i+=numThreads){
+        (*res)[i]=index->topKSearch(*(*queries)[i],k,threshold);
+      }
+    }
+    void checkQueries(const std::vector<const ExplicitBitVect *> &queries,
+                      unsigned int numBits){
+      for(unsigned int i=0;i<queries.size();++i){
+        PRECONDITION(queries[i],"bad query");
+        if(queries[i]->getNumBits()!=numBits){
+          throw ValueErrorException("query size does not match the index");
+        }
+      }
+    }
+  }
+
+  std::vector<SimilarityHitVect>
+  TanimotoSearchIndex::thresholdSearch(const std::vector<const ExplicitBitVect *> &queries,
+                                       double threshold,int numThreads) const {
+    // check up front so that we don't throw from a worker thread
+    checkQueries(queries,getNumBits());
+    std::vector<SimilarityHitVect> res(queries.size());
+    unsigned int nThreads=std::min(getNumThreadsToUse(numThreads),
+                                   static_cast<unsigned int>(queries.size()));
+    if(nThreads<=1){
+      runThresholdSearches(this,&queries,threshold,&res,0,1);
+    }
+#ifdef RDK_THREADSAFE_SSS
+    else {
+      boost::thread_group tg;
+      for(unsigned int ti=0;ti<nThreads;++ti){
+        tg.add_thread(new boost::thread(runThresholdSearches,this,&queries,threshold,
+                                        &res,ti,nThreads));
+      }
+      tg.join_all();
+    }
+#endif
+    return res;
+  }
+
+  std::vector<SimilarityHitVect>
+  TanimotoSearchIndex::topKSearch(const std::vector<const ExplicitBitVect *> &queries,
+                                  unsigned int k,double threshold,
+                                  int numThreads) const {
+    checkQueries(queries,getNumBits());
+    std::vector<SimilarityHitVect> res(queries.size());
+    unsigned int nThreads=std::min(getNumThreadsToUse(numThreads),
+                                   static_cast<unsigned int>(queries.size()));
+    if(nThreads<=1){
+      runTopKSearches(this,&queries,k,threshold,&res,0,1);
+    }
+#ifdef RDK_THREADSAFE_SSS
+    else {
+      boost::thread_group tg;
+      for(unsigned int ti=0;ti<nThreads;++ti){
+        tg.add_thread(new boost::thread(runTopKSearches,this,&queries,k,threshold,
+                                        &res,ti,nThreads));
+      }
+      tg.join_all();
+    }
+#endif
+    return res;
+  }
+
+  namespace {
+    struct NeighborPair {
+      boost::uint32_t i,j;
+      float sim;
+    };
+
+    // finds the neighbors of the records at positions threadIdx,
+    // threadIdx+numThreads, ... that have the same or higher popcount
+    // and a higher position; this way each pair is only looked at once
+    void findNeighborPairs(const detail::SortedFingerprintView *view,
+                           double threshold,std::vector<NeighborPair> *res,
+                           unsigned int threadIdx,unsigned int numThreads){
+      const unsigned int numBits=view->numBits;
+      const unsigned int nItems=view->binStarts[numBits+1];
+      unsigned int bin=0;
+      for(unsigned int p=threadIdx;p<nItems;p+=numThreads){
+        while(view->binStarts[bin+1]<=p) ++bin;
+        unsigned int hi=numBits;
+        if(threshold>0){
+          double dhi=std::floor(bin/threshold+BOUND_TOL);
+          hi = dhi<numBits ? static_cast<unsigned int>(dhi) : numBits;
+        }
+        const unsigned char *fp=view->bitmaps+static_cast<size_t>(p)*view->stride;
+        for(unsigned int tbin=bin;tbin<=hi;++tbin){
+          unsigned int q=std::max(p+1,view->binStarts[tbin]);
+          for(;q<view->binStarts[tbin+1];++q){
+            unsigned int nCommon=CalcBitmapNumBitsInCommon(fp,
+                                                           view->bitmaps+static_cast<size_t>(q)*view->stride,
+                                                           view->stride);
+            double sim=tanimoto(bin,tbin,nCommon);
+            if(sim>=threshold){
+              NeighborPair pair;
+              pair.i=view->ids[p];
+              pair.j=view->ids[q];
+              pair.sim=static_cast<float>(sim);
+              res->push_back(pair);
+            }
+          }
+        }
+      }
+    }
+  }
+
+  void GetTanimotoNeighborList(const FingerprintArena &fps,double threshold,
+                               SimilarityNeighborList &res,int numThreads){
+    const unsigned int nItems=fps.size();
+    res.offsets.clear();
+    res.offsets.resize(nItems+1,0);
+    res.neighbors.clear();
+    res.similarities.clear();
+    if(nItems<2) return;
+
+    TanimotoSearchIndex index(fps);
+    detail::SortedFingerprintView view=index.getView();
+    unsigned int nThreads=std::min(getNumThreadsToUse(numThreads),nItems);
+    std::vector< std::vector<NeighborPair> > pairs(nThreads);
+    if(nThreads<=1){
+      findNeighborPairs(&view,threshold,&pairs[0],0,1);
+    }
+#ifdef RDK_THREADSAFE_SSS
+    else {
+      boost::thread_group tg;
+      for(unsigned int ti=0;ti<nThreads;++ti){
+        tg.add_thread(new boost::thread(findNeighborPairs,&view,threshold,
+                                        &pairs[ti],ti,nThreads));
+      }
+      tg.join_all();
+    }
+#endif
+
+    // each pair goes into the lists of both of its members:
+    for(unsigned int ti=0;ti<pairs.size();++ti){
+      for(unsigned int k=0;k<pairs[ti].size();++k){
+        ++res.offsets[pairs[ti][k].i+1];
+        ++res.offsets[pairs[ti][k].j+1];
+      }
+    }
+    for(unsigned int i=0;i<nItems;++i){
+      res.offsets[i+1]+=res.offsets[i];
+    }
+    res.neighbors.resize(res.offsets[nItems]);
+    res.similarities.resize(res.offsets[nItems]);
+    std::vector<boost::uint64_t> nextPos(res.offsets.begin(),res.offsets.end()-1);
+    for(unsigned int ti=0;ti<pairs.size();++ti){
+      for(unsigned int k=0;k<pairs[ti].size();++k){
+        const NeighborPair &pair=pairs[ti][k];
+        boost::uint64_t pos=nextPos[pair.i]++;
+        res.neighbors[pos]=pair.j;
+        res.similarities[pos]=pair.sim;
+        pos=nextPos[pair.j]++;
+        res.neighbors[pos]=pair.i;
+        res.similarities[pos]=pair.sim;
+      }
+      // release the memory as we go
+      std::vector<NeighborPair>().swap(pairs[ti]);
+    }
+
+    // the order of the pairs depends on the number of threads; sort
+    // each list so that the results don't
+    std::vector< std::pair<boost::uint32_t,float> > row;
+    for(unsigned int i=0;i<nItems;++i){
+      boost::uint64_t first=res.offsets[i],last=res.offsets[i+1];
+      row.clear();
+      for(boost::uint64_t pos=first;pos<last;++pos){
+        row.push_back(std::make_pair(res.neighbors[pos],res.similarities[pos]));
+      }
+      std::sort(row.begin(),row.end());
+      for(boost::uint64_t pos=first;pos<last;++pos){
+        res.neighbors[pos]=row[pos-first].first;
+        res.similarities[pos]=row[pos-first].second;
+      }
+    }
+  }
+
+  void GetTanimotoNeighborList(const std::vector<const ExplicitBitVect *> &fps,
+                               double threshold,SimilarityNeighborList &res,
+                               int numThreads){
+    if(fps.empty()){
+      res.offsets.assign(1,0);
+      res.neighbors.clear();
+      res.similarities.clear();
+      return;
+    }
+    PRECONDITION(fps[0],"bad fingerprint");
+    FingerprintArena arena(fps[0]->getNumBits());
+    arena.reserve(fps.size());
+    for(unsigned int i=0;i<fps.size();++i){
+      PRECONDITION(fps[i],"bad fingerprint");
+      arena.addFingerprint(*fps[i]);
+    }
+    GetTanimotoNeighborList(arena,threshold,res,numThreads);
+  }
+}
@@ -0,0 +1,158 @@
+//
+//  Copyright (C) 2013 Greg Landrum and Rational Discovery LLC
+//
+//  @@ All Rights Reserved @@
+//  This file is part of the RDKit.
+//  The contents are covered by the terms of the BSD license
+//  which is included in the file license.txt, found at the root
+//  of the RDKit source tree.
+//
+#ifndef __RD_SIMILARITYSEARCH_H__
+#define __RD_SIMILARITYSEARCH_H__
+/*! \file SimilaritySearch.h
+
+  \brief Tanimoto similarity searching with popcount pruning.
+
+*/
+
+#include <vector>
+#include <utility>
+#include <boost/cstdint.hpp>
+#include "ExplicitBitVect.h"
+#include "FingerprintArena.h"
+
+namespace RDKit {
+  //! a search hit: (similarity, index of the fingerprint in the original arena)
+  typedef std::pair<double,unsigned int> SimilarityHit;
+  typedef std::vector<SimilarityHit> SimilarityHitVect;
+
+  namespace detail {
+    //! a non-owning view of a set of fingerprints sorted by popcount
+    /*!
+      This is what the search code actually works on; it allows the
+      same code to be used for fingerprints in memory and in a
+      memory-mapped file (see FingerprintDB).
+
+      The records can take up more than 4GB, so offsets into \c bitmaps
+      must be computed in size_t, not as <tt>pos*stride</tt> in
+      unsigned ints.
+    */
+    struct SortedFingerprintView {
+      const unsigned char *bitmaps;      //!< the padded records, one after the other
+      unsigned int stride;               //!< the number of bytes in each record
+      unsigned int numBits;              //!< the number of bits in each fingerprint
+      const boost::uint32_t *binStarts;  //!< numBits+2 entries, position of the first fp with each popcount
+      const boost::uint32_t *ids;        //!< the id reported for each record, may be null
+    };
+
+    //! \c query must be padded to \c view.stride bytes
+    void thresholdSearch(const SortedFingerprintView &view,
+                         const unsigned char *query,unsigned int queryCount,
+                         double threshold,SimilarityHitVect &res);
+    //! \overload
+    void topKSearch(const SortedFingerprintView &view,
+                    const unsigned char *query,unsigned int queryCount,
+                    unsigned int k,double threshold,SimilarityHitVect &res);
+  }
+
+  //! an index for fast Tanimoto searches over a set of fingerprints
+  /*!
+    The fingerprints are sorted by popcount. For a query with \c A bits
+    set and a target with \c B bits set the Tanimoto similarity can be
+    no larger than <tt>min(A,B)/max(A,B)</tt>, so for a threshold \c t
+    only targets with <tt>t*A <= B <= A/t</tt> need to be examined.
+    Top-k searches visit the popcount bins in order of decreasing upper
+    bound and stop as soon as no remaining bin can improve the results.
+
+    Results are sorted by decreasing similarity, ties are broken by
+    index. The indices refer to positions in the arena used to
+    construct the index.
+
+    The index is immutable once constructed, so it can be searched
+    from any number of threads at once.
+  */
+  class TanimotoSearchIndex {
+  public:
+    //! construct from a set of fingerprints (the fingerprints are copied)
+    explicit TanimotoSearchIndex(const FingerprintArena &fps);
+
+    //! returns all fingerprints with similarity >= \c threshold to the query
+    SimilarityHitVect thresholdSearch(const ExplicitBitVect &query,
+                                      double threshold) const;
+    //! returns the \c k most similar fingerprints
+    /*!
+      \param query      the query fingerprint
+      \param k          the maximum number of results to return
+      \param threshold  (optional) only return hits with at least this similarity
+    */
+    SimilarityHitVect topKSearch(const ExplicitBitVect &query,unsigned int k,
+                                 double threshold=0.0) const;
+
+    //! \name batched searches
+    /*!
+      The queries are distributed across \c numThreads threads (see
+      getNumThreadsToUse() for the meaning of values <=0). The results
+      are in the same order as the queries.
+    */
+    //@{
+    std::vector<SimilarityHitVect>
+    thresholdSearch(const std::vector<const ExplicitBitVect *> &queries,
+                    double threshold,int numThreads=1) const;
+    std::vector<SimilarityHitVect>
+    topKSearch(const std::vector<const ExplicitBitVect *> &queries,
+               unsigned int k,double threshold=0.0,int numThreads=1) const;
+    //@}
+
+    //! returns the number of fingerprints in the index
+    unsigned int size() const { return d_fps.size(); };
+    //! returns the number of bits in the fingerprints
+    unsigned int getNumBits() const { return d_fps.getNumBits(); };
+    //! returns a view of the sorted fingerprints, valid for the lifetime of the index
+    detail::SortedFingerprintView getView() const;
+
+  private:
+    FingerprintArena d_fps;                   //!< sorted by popcount
+    std::vector<boost::uint32_t> d_ids;       //!< original index of each fingerprint
+    std::vector<boost::uint32_t> d_binStarts; //!< position of the first fp with each popcount
+  };
+
+  //! the neighbors of each of a set of fingerprints, in compressed sparse row form
+  /*!
+    The neighbors of item \c i are
+    <tt>neighbors[offsets[i]]...neighbors[offsets[i+1]-1]</tt>, sorted
+    by increasing index, with the corresponding similarities in
+    \c similarities. An item is not its own neighbor.
+  */
+  struct SimilarityNeighborList {
+    std::vector<boost::uint64_t> offsets;    //!< size()+1 entries
+    std::vector<boost::uint32_t> neighbors;
+    std::vector<float> similarities;
+
+    //! returns the number of items
+    unsigned int size() const { return offsets.empty() ? 0 : offsets.size()-1; };
+    //! returns the number of neighbors of item \c i
+    unsigned int getNumNeighbors(unsigned int i) const {
+      return static_cast<unsigned int>(offsets[i+1]-offsets[i]);
+    };
+  };
+
+  //! finds all pairs of fingerprints with Tanimoto similarity >= \c threshold
+  /*!
+    \param fps         the fingerprints
+    \param threshold   the similarity threshold
+    \param res         used to return the neighbor lists
+    \param numThreads  the number of threads to use (see getNumThreadsToUse())
+
+    The fingerprints are sorted by popcount and each pair is only
+    considered once, so only the pairs which could pass the threshold
+    are compared and the full similarity matrix is never constructed.
+  */
+  void GetTanimotoNeighborList(const FingerprintArena &fps,double threshold,
+                               SimilarityNeighborList &res,int numThreads=1);
+  //! \overload
+  void GetTanimotoNeighborList(const std::vector<const ExplicitBitVect *> &fps,
+                               double threshold,SimilarityNeighborList &res,
+                               int numThreads=1);
+}
+
+#endif
@@ -11,7 +11,8 @@
 #ifndef __RD_SPARSE_INT_VECT_20070921__
 #define __RD_SPARSE_INT_VECT_20070921__
 
-#include <map>
+#include <vector>
+#include <algorithm>
 #include <string>
 #include <RDGeneral/Invariant.h>
 #include <sstream>
@@ -20,13 +21,23 @@
 #include <boost/cstdint.hpp>
 
 
-const int ci_SPARSEINTVECT_VERSION=0x0001; //!< version number to use in pickles
+const int ci_SPARSEINTVECT_VERSION=0x0002; //!< version number to use in pickles
 namespace RDKit{
   //! a class for efficiently storing sparse vectors of ints
+  /*!
+    The nonzero elements are stored as (index,value) pairs in a vector
+    sorted by index. Lookups are binary searches and the operations
+    which combine two vectors (including the similarity functions
+    below) are linear merges.
+
+    Setting values one at a time in random order costs O(N) per
+    insertion; when building a vector from a set of indices use
+    updateFromSequence(), which sorts them first.
+  */
   template <typename IndexType>
   class SparseIntVect {
   public:
-    typedef std::map<IndexType,int> StorageType;
+    typedef std::vector<std::pair<IndexType,int> > StorageType;
   
     SparseIntVect() : d_length(0) {};
 
@@ -36,7 +47,7 @@ namespace RDKit{
     //! Copy constructor
     SparseIntVect(const SparseIntVect<IndexType> &other){
       d_length=other.d_length;
-      d_data.insert(other.d_data.begin(),other.d_data.end());
+      d_data=other.d_data;
     }
 
     //! constructor from a pickle
@@ -61,8 +72,9 @@ namespace RDKit{
         throw IndexErrorException(static_cast<int>(idx));
       }
       int res=0;
-      typename StorageType::const_iterator iter=d_data.find(idx);
-      if(iter!=d_data.end()){
+      typename StorageType::const_iterator iter=std::lower_bound(d_data.begin(),d_data.end(),
+                                                                 idx,IndexLess());
+      if(iter!=d_data.end() && iter->first==idx){
         res=iter->second;
       }
       return res;
@@ -73,12 +85,52 @@ namespace RDKit{
       if(idx<0||idx>=d_length){
         throw IndexErrorException(static_cast<int>(idx));
       }
-      if(val!=0){
-        d_data[idx]=val;
-      } else {
-        d_data.erase(idx);
+      typename StorageType::iterator iter=std::lower_bound(d_data.begin(),d_data.end(),
+                                                           idx,IndexLess());
+      if(iter!=d_data.end() && iter->first==idx){
+        if(val!=0){
+          iter->second=val;
+        } else {
+          d_data.erase(iter);
+        }
+      } else if(val!=0){
+        d_data.insert(iter,std::make_pair(idx,val));
       }
     };
+
+    //! adds one to the value at each index in a sequence
+    /*!
+      The indices are sorted and merged with the existing elements in
+      a single pass, which is much faster than calling setVal() for
+      each of them. \c indices is modified.
+      Throws an IndexErrorException if any index is out of range.
+    */
+    void addCounts(std::vector<IndexType> &indices){
+      if(indices.empty()) return;
+      std::sort(indices.begin(),indices.end());
+      // after sorting, only the smallest and largest indices need to
+      // be checked:
+      if(indices.front()<0){
+        throw IndexErrorException(static_cast<int>(indices.front()));
+      }
+      if(indices.back()>=d_length){
+        throw IndexErrorException(static_cast<int>(indices.back()));
+      }
+      StorageType counts;
+      counts.reserve(indices.size());
+      typename std::vector<IndexType>::const_iterator idxIt=indices.begin();
+      while(idxIt!=indices.end()){
+        typename std::vector<IndexType>::const_iterator runEnd=idxIt+1;
+        while(runEnd!=indices.end() && *runEnd==*idxIt) ++runEnd;
+        counts.push_back(std::make_pair(*idxIt,static_cast<int>(runEnd-idxIt)));
+        idxIt=runEnd;
+      }
+      if(d_data.empty()){
+        d_data.swap(counts);
+      } else {
+        mergeWith(counts,Add());
+      }
+    }
 #ifdef __clang__
 #pragma clang diagnostic pop
 #endif
@@ -103,7 +155,7 @@ namespace RDKit{
     unsigned int size() const { return getLength(); };
 
 
-    //! returns our nonzero elements as a map(IndexType->int)
+    //! returns our nonzero elements as a vector of (IndexType,int) pairs sorted by index
     const StorageType &getNonzeroElements() const {
       return d_data;
     }
@@ -118,29 +170,26 @@ namespace RDKit{
         throw ValueErrorException("SparseIntVect size mismatch");
       }
 
-      typename StorageType::iterator iter=d_data.begin();
+      // elements are only ever removed, so this can be done in place:
+      typename StorageType::iterator outIter=d_data.begin();
+      typename StorageType::const_iterator iter=d_data.begin();
       typename StorageType::const_iterator oIter=other.d_data.begin();
-      while(iter!=d_data.end()){
-        // we're relying on the fact that the maps are sorted:
-        while(oIter!=other.d_data.end() && oIter->first < iter->first){
+      while(iter!=d_data.end() && oIter!=other.d_data.end()){
+        if(oIter->first < iter->first){
           ++oIter;
-        }
-        if(oIter!=other.d_data.end() && oIter->first==iter->first){
-          // found it:
+        } else if(iter->first < oIter->first){
+          ++iter;
+        } else {
+          *outIter=*iter;
           if(oIter->second<iter->second){
-            iter->second=oIter->second;
+            outIter->second=oIter->second;
           }
-          ++oIter;
+          ++outIter;
           ++iter;
-        } else {
-          // not there; our value is zero, which means
-          // we should remove this value:
-          typename StorageType::iterator tmpIter=iter;
-          ++tmpIter;
-          d_data.erase(iter);
-          iter=tmpIter;
+          ++oIter;
         }
       }
+      d_data.erase(outIter,d_data.end());
       return *this;
     };
     const SparseIntVect<IndexType> 
@@ -157,30 +206,7 @@ namespace RDKit{
       if(other.d_length!=d_length){
         throw ValueErrorException("SparseIntVect size mismatch");
       }
-
-      typename StorageType::iterator iter=d_data.begin();
-      typename StorageType::const_iterator oIter=other.d_data.begin();
-      while(iter!=d_data.end()){
-        // we're relying on the fact that the maps are sorted:
-        while(oIter!=other.d_data.end() &&
-              oIter->first < iter->first){
-          d_data[oIter->first]=oIter->second;
-          ++oIter;
-        }
-        if(oIter!=other.d_data.end() && oIter->first==iter->first){
-          // found it:
-          if(oIter->second>iter->second){
-            iter->second=oIter->second;
-          }
-          ++oIter;
-        }
-        ++iter;
-      }
-      // finish up the other vect:
-      while(oIter!=other.d_data.end()){
-        d_data[oIter->first]=oIter->second;
-        ++oIter;
-      }
+      mergeWith(other.d_data,Max());
       return *this;
     };
     const SparseIntVect<IndexType> 
@@ -194,29 +220,7 @@ namespace RDKit{
       if(other.d_length!=d_length){
         throw ValueErrorException("SparseIntVect size mismatch");
       }
-      typename StorageType::iterator iter=d_data.begin();
-      typename StorageType::const_iterator oIter=other.d_data.begin();
-      while(oIter!=other.d_data.end()){
-        while(iter!=d_data.end() &&
-              iter->first < oIter->first){
-          ++iter;
-        }
-        if(iter!=d_data.end() && oIter->first==iter->first){
-          // found it:
-          iter->second+=oIter->second;
-          if(!iter->second){
-            typename StorageType::iterator tIter=iter;
-            ++tIter;
-            d_data.erase(iter);
-            iter=tIter;
-          } else {
-            ++iter;
-          }
-        } else {
-          d_data[oIter->first]=oIter->second;
-        }
-        ++oIter;
-      }
+      mergeWith(other.d_data,Add());
       return *this;
     };
     const SparseIntVect<IndexType> 
@@ -230,29 +234,7 @@ namespace RDKit{
       if(other.d_length!=d_length){
         throw ValueErrorException("SparseIntVect size mismatch");
       }
-      typename StorageType::iterator iter=d_data.begin();
-      typename StorageType::const_iterator oIter=other.d_data.begin();
-      while(oIter!=other.d_data.end()){
-        while(iter!=d_data.end() &&
-              iter->first < oIter->first){
-          ++iter;
-        }
-        if(iter!=d_data.end() && oIter->first==iter->first){
-          // found it:
-          iter->second-=oIter->second;
-          if(!iter->second){
-            typename StorageType::iterator tIter=iter;
-            ++tIter;
-            d_data.erase(iter);
-            iter=tIter;
-          } else {
-            ++iter;
-          }
-        } else {
-          d_data[oIter->first] = -oIter->second;
-        }
-        ++oIter;
-      }
+      mergeWith(other.d_data,Subtract());
       return *this;
     };
     const SparseIntVect<IndexType> 
@@ -328,6 +310,11 @@ namespace RDKit{
     }
 
     //! returns a binary string representation (pickle)
+    /*!
+      The indices are stored as variable-length deltas from the
+      previous index and the values as variable-length zigzag-encoded
+      ints, so a typical count fingerprint needs 2-4 bytes per element.
+    */
     std::string toString() const {
       std::stringstream ss(std::ios_base::binary|std::ios_base::out|std::ios_base::in);
       boost::uint32_t tInt;
@@ -336,14 +323,17 @@ namespace RDKit{
       tInt=sizeof(IndexType);
       streamWrite(ss,tInt);
       streamWrite(ss,d_length);
-      IndexType nEntries=d_data.size();
-      streamWrite(ss,nEntries);
+      writeVarInt(ss,d_data.size());
 
+      boost::uint64_t prev=0;
       typename StorageType::const_iterator iter=d_data.begin();
       while(iter!=d_data.end()){
-        streamWrite(ss,iter->first);
-        boost::int32_t tInt=iter->second;
-        streamWrite(ss,tInt);
+        boost::uint64_t idx=static_cast<boost::uint64_t>(iter->first);
+        writeVarInt(ss,idx-prev);
+        prev=idx;
+        boost::int64_t val=iter->second;
+        writeVarInt(ss,(static_cast<boost::uint64_t>(val)<<1) ^
+                    static_cast<boost::uint64_t>(val>>63));
         ++iter;
       }
       return ss.str();
@@ -356,6 +346,80 @@ namespace RDKit{
   private:
     IndexType d_length;
     StorageType d_data;
+
+    struct IndexLess {
+      bool operator()(const typename StorageType::value_type &v,IndexType idx) const {
+        return v.first<idx;
+      }
+    };
+    // the operations used by mergeWith(); left() and right() give the
+    // result for elements only present in one of the two vectors
+    struct Add {
+      int operator()(int v1,int v2) const { return v1+v2; }
+      int left(int v) const { return v; }
+      int right(int v) const { return v; }
+    };
+    struct Subtract {
+      int operator()(int v1,int v2) const { return v1-v2; }
+      int left(int v) const { return v; }
+      int right(int v) const { return -v; }
+    };
+    struct Max {
+      int operator()(int v1,int v2) const { return v1>v2 ? v1 : v2; }
+      int left(int v) const { return v; }
+      int right(int v) const { return v; }
+    };
+
+    //! merges \c other into our data in a single pass
+    template <typename Op>
+    void mergeWith(const StorageType &other,const Op &op){
+      StorageType res;
+      res.reserve(d_data.size()+other.size());
+      typename StorageType::const_iterator iter=d_data.begin();
+      typename StorageType::const_iterator oIter=other.begin();
+      while(iter!=d_data.end() || oIter!=other.end()){
+        typename StorageType::value_type elem;
+        if(oIter==other.end() ||
+           (iter!=d_data.end() && iter->first < oIter->first)){
+          elem=std::make_pair(iter->first,op.left(iter->second));
+          ++iter;
+        } else if(iter==d_data.end() || oIter->first < iter->first){
+          elem=std::make_pair(oIter->first,op.right(oIter->second));
+          ++oIter;
+        } else {
+          elem=std::make_pair(iter->first,op(iter->second,oIter->second));
+          ++iter;
+          ++oIter;
+        }
+        if(elem.second) res.push_back(elem);
+      }
+      d_data.swap(res);
+    }
+
+    static void writeVarInt(std::stringstream &ss,boost::uint64_t val){
+      while(val>=0x80){
+        char tc=static_cast<char>((val&0x7F)|0x80);
+        ss.write(&tc,1);
+        val>>=7;
+      }
+      char tc=static_cast<char>(val);
+      ss.write(&tc,1);
+    }
+    static boost::uint64_t readVarInt(std::stringstream &ss){
+      boost::uint64_t res=0;
+      unsigned int shift=0;
+      while(1){
+        char tc;
+        ss.read(&tc,1);
+        if(!ss || shift>63){
+          throw ValueErrorException("bad SparseIntVect pickle");
+        }
+        res|=static_cast<boost::uint64_t>(tc&0x7F)<<shift;
+        if(!(tc&0x80)) break;
+        shift+=7;
+      }
+      return res;
+    }
     
     void initFromText(const char *pkl,const unsigned int len) {
       d_data.clear();
@@ -364,7 +428,7 @@ namespace RDKit{
       
       boost::uint32_t vers;
       streamRead(ss,vers);
-      if(vers==0x0001){
+      if(vers==0x0001 || vers==0x0002){
         boost::uint32_t tInt;
         streamRead(ss,tInt);
         if(tInt>sizeof(IndexType)){
@@ -372,11 +436,11 @@ namespace RDKit{
         }
         switch(tInt){
         case sizeof(char):
-          readVals<unsigned char>(ss);break;
+          readVals<unsigned char>(ss,vers);break;
         case sizeof(boost::int32_t):
-          readVals<boost::uint32_t>(ss);break;
+          readVals<boost::uint32_t>(ss,vers);break;
         case sizeof(boost::int64_t):
-          readVals<boost::uint64_t>(ss);break;
+          readVals<boost::uint64_t>(ss,vers);break;
         default:
           throw ValueErrorException("unreadable format");
         }
@@ -385,18 +449,42 @@ namespace RDKit{
       }
     };
     template <typename T>
-    void readVals(std::stringstream &ss){
+    void readVals(std::stringstream &ss,boost::uint32_t vers){
       PRECONDITION(sizeof(T)<=sizeof(IndexType),"invalid size");
       T tVal;
       streamRead(ss,tVal);
       d_length=tVal;
-      T nEntries;
-      streamRead(ss,nEntries);
-      for(T i=0;i<nEntries;++i){
-        streamRead(ss,tVal);
-        boost::int32_t val;
-        streamRead(ss,val);
-        d_data[tVal]=val;
+      if(vers==0x0001){
+        T nEntries;
+        streamRead(ss,nEntries);
+        d_data.reserve(nEntries);
+        for(T i=0;i<nEntries;++i){
+          streamRead(ss,tVal);
+          boost::int32_t val;
+          streamRead(ss,val);
+          d_data.push_back(std::make_pair(static_cast<IndexType>(tVal),
+                                          static_cast<int>(val)));
+        }
+      } else {
+        const boost::uint64_t length=tVal;
+        boost::uint64_t nEntries=readVarInt(ss);
+        // each entry takes at least two bytes, so a bad count can't
+        // make us allocate more than the pickle's size:
+        std::streamsize avail=ss.rdbuf()->in_avail();
+        boost::uint64_t maxEntries=avail>0 ? avail/2 : 0;
+        d_data.reserve(std::min(nEntries,std::min(maxEntries,length)));
+        boost::uint64_t idx=0;
+        for(boost::uint64_t i=0;i<nEntries;++i){
+          boost::uint64_t delta=readVarInt(ss);
+          if((i && !delta) || delta>=length || idx+delta>=length){
+            throw ValueErrorException("bad index in SparseIntVect pickle");
+          }
+          idx+=delta;
+          boost::uint64_t zz=readVarInt(ss);
+          boost::int64_t val=static_cast<boost::int64_t>(zz>>1) ^ -static_cast<boost::int64_t>(zz&1);
+          d_data.push_back(std::make_pair(static_cast<IndexType>(idx),
+                                          static_cast<int>(val)));
+        }
       }
     }
   };
@@ -404,12 +492,8 @@ namespace RDKit{
   template <typename IndexType, typename SequenceType>
   void updateFromSequence(SparseIntVect<IndexType> &vect,
                           const SequenceType &seq){
-    typename SequenceType::const_iterator seqIt;
-    for(seqIt=seq.begin();seqIt!=seq.end();++seqIt){
-      // EFF: probably not the most efficient approach
-      IndexType idx=*seqIt;
-      vect.setVal(idx,vect.getVal(idx)+1);
-    }
+    std::vector<IndexType> indices(seq.begin(),seq.end());
+    vect.addCounts(indices);
   }
 
   namespace {
@@ -423,47 +507,31 @@ namespace RDKit{
       }
       v1Sum=v2Sum=andSum=0.0;
       // we're doing : (v1&v2).getTotalVal(), but w/o generating
-      // the other vector:
-      typename SparseIntVect<IndexType>::StorageType::const_iterator iter1,iter2;
-      iter1=v1.getNonzeroElements().begin();
-      if(iter1!=v1.getNonzeroElements().end()) v1Sum+=abs(iter1->second); 
-      iter2=v2.getNonzeroElements().begin();
-      if(iter2!=v2.getNonzeroElements().end()) v2Sum+=abs(iter2->second); 
-      while(iter1 != v1.getNonzeroElements().end()){
-        while(iter2!=v2.getNonzeroElements().end() && iter2->first < iter1->first){
-          ++iter2;
-          if(iter2!=v2.getNonzeroElements().end()) v2Sum+=abs(iter2->second); 
-        }
-        if(iter2!=v2.getNonzeroElements().end()){
-          if(iter2->first == iter1->first){
-            if(abs(iter2->second)<abs(iter1->second)){
-              andSum += abs(iter2->second);
-            } else {
-              andSum += abs(iter1->second);
-            }
-            ++iter2;
-            if(iter2!=v2.getNonzeroElements().end()) v2Sum+=abs(iter2->second); 
-          }
-          ++iter1;
-          if(iter1!=v1.getNonzeroElements().end()) v1Sum+=abs(iter1->second); 
-        } else {
-          break;
-        }
-      }
-      if(iter1 != v1.getNonzeroElements().end()){
-        ++iter1;
-        while(iter1!=v1.getNonzeroElements().end()){
+      // the other vector. Both element lists are sorted, so this
+      // is a simple merge:
+      typedef typename SparseIntVect<IndexType>::StorageType StorageType;
+      const StorageType &d1=v1.getNonzeroElements();
+      const StorageType &d2=v2.getNonzeroElements();
+      typename StorageType::const_iterator iter1=d1.begin(),end1=d1.end();
+      typename StorageType::const_iterator iter2=d2.begin(),end2=d2.end();
+      while(iter1!=end1 && iter2!=end2){
+        if(iter1->first < iter2->first){
           v1Sum+=abs(iter1->second);
           ++iter1;
-        }
-      }
-      if(iter2!=v2.getNonzeroElements().end()){
-        ++iter2;
-        while(iter2!=v2.getNonzeroElements().end()){
+        } else if(iter2->first < iter1->first){
           v2Sum+=abs(iter2->second);
           ++iter2;
+        } else {
+          int a1=abs(iter1->second),a2=abs(iter2->second);
+          v1Sum+=a1;
+          v2Sum+=a2;
+          andSum+= a1<a2 ? a1 : a2;
+          ++iter1;
+          ++iter2;
         }
       }
+      for(;iter1!=end1;++iter1) v1Sum+=abs(iter1->second);
+      for(;iter2!=end2;++iter2) v2Sum+=abs(iter2->second);
     }
   }
   
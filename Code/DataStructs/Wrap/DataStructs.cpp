@@ -28,6 +28,7 @@ void wrap_BitOps();
 void wrap_Utils();
 void wrap_discreteValVect();
 void wrap_sparseIntVect();
+void wrap_FingerprintArena();
 
 template <typename T>
 void convertToNumpyArray(const T &v,python::object destArray){
@@ -62,6 +63,7 @@ BOOST_PYTHON_MODULE(cDataStructs)
     "    - SparseBitVect:   class for large, sparse bit vectors\n"
     "  DiscreteValueVect:   class for storing vectors of integers\n"
     "  SparseIntVect:       class for storing sparse vectors of integers\n"
+    "  FingerprintArena:    class for compactly storing sets of ExplicitBitVects\n"
     ;
   
   python::register_exception_translator<IndexErrorException>(&translate_index_error);
@@ -73,6 +75,9 @@ BOOST_PYTHON_MODULE(cDataStructs)
   wrap_BitOps();
   wrap_discreteValVect();
   wrap_sparseIntVect();
+  // this needs to come after wrap_BitOps() so that its bulk similarity
+  // overloads are tried first
+  wrap_FingerprintArena();
 
   python::def("ConvertToNumpyArray", (void (*)(const ExplicitBitVect &,python::object))convertToNumpyArray,
               (python::arg("bv"),python::arg("destArray")));
@@ -33,10 +33,12 @@ namespace {
   void pyUpdateFromSequence(SparseIntVect<IndexType> &vect,
 			    python::object &seq){
     PySequenceHolder<IndexType> seqL(seq);
+    std::vector<IndexType> indices;
+    indices.reserve(seqL.size());
     for(unsigned int i=0;i<seqL.size();++i){
-      IndexType idx=seqL[i];
-      vect.setVal(idx,vect[idx]+1);
+      indices.push_back(seqL[i]);
     }
+    updateFromSequence(vect,indices);
   }
   template <typename IndexType>
   python::dict pyGetNonzeroElements(SparseIntVect<IndexType> &vect){
@@ -290,6 +290,76 @@ class TestCase(unittest.TestCase):
         sim = DataStructs.DiceSimilarity(bvs[0],bvs[i])
         self.failUnless(feq(sim,sims[i]))
 
-      
+   def test11FingerprintArena(self):
+      nbits = 200
+      bvs = []
+      for fp in [(1,2,3,4,5),(1,2,3),(3,4,5,6,7,199),(10,20,30,150),()]:
+        bv = DataStructs.ExplicitBitVect(nbits)
+        for bit in fp:
+          bv.SetBit(bit)
+        bvs.append(bv)
+      arena = DataStructs.FingerprintArena(nbits)
+      arena.AddFingerprints(bvs)
+      self.failUnlessEqual(len(arena),len(bvs))
+      self.failUnlessEqual(arena.GetNumBits(),nbits)
+      for i,bv in enumerate(bvs):
+        self.failUnlessEqual(arena.GetPopcount(i),bv.GetNumOnBits())
+        self.failUnless(arena.GetFingerprint(i)==bv)
+
+      sims = DataStructs.BulkTanimotoSimilarity(bvs[0],arena)
+      self.failUnless(isinstance(sims,numpy.ndarray))
+      self.failUnlessEqual(len(sims),len(bvs))
+      for i in range(len(bvs)):
+        self.failUnless(feq(sims[i],DataStructs.TanimotoSimilarity(bvs[0],bvs[i])))
+      sims = DataStructs.BulkTanimotoSimilarity(bvs[0],arena,returnDistance=1)
+      for i in range(len(bvs)):
+        self.failUnless(feq(sims[i],1-DataStructs.TanimotoSimilarity(bvs[0],bvs[i])))
+      sims = DataStructs.BulkDiceSimilarity(bvs[2],arena)
+      for i in range(len(bvs)):
+        self.failUnless(feq(sims[i],DataStructs.DiceSimilarity(bvs[2],bvs[i])))
+      sims = DataStructs.BulkTverskySimilarity(bvs[2],arena,.3,.7)
+      for i in range(len(bvs)):
+        self.failUnless(feq(sims[i],DataStructs.TverskySimilarity(bvs[2],bvs[i],.3,.7)))
+
+      # the list versions still work:
+      sims = DataStructs.BulkTanimotoSimilarity(bvs[0],bvs)
+      self.failUnless(isinstance(sims,list))
+
+      self.failUnlessRaises(ValueError,lambda:arena.AddFingerprint(DataStructs.ExplicitBitVect(10)))
+      self.failUnlessRaises(ValueError,lambda:DataStructs.BulkTanimotoSimilarity(DataStructs.ExplicitBitVect(10),arena))
+
+   def test12TanimotoSearchIndex(self):
+      random.seed(23)
+      nbits = 256
+      bvs = []
+      for i in range(100):
+        bv = DataStructs.ExplicitBitVect(nbits)
+        bv.SetBitsFromList(range(10))
+        bv.SetBitsFromList([random.randint(0,nbits-1) for x in range(random.randint(0,50))])
+        bvs.append(bv)
+      arena = DataStructs.FingerprintArena(nbits)
+      arena.AddFingerprints(bvs)
+      index = DataStructs.TanimotoSearchIndex(arena)
+      self.failUnlessEqual(len(index),len(bvs))
+
+      sims = DataStructs.BulkTanimotoSimilarity(bvs[0],bvs)
+      hits = index.ThresholdSearch(bvs[0],0.4)
+      self.failUnlessEqual(len(hits),len([x for x in sims if x>=0.4]))
+      for sim,idx in hits:
+        self.failUnless(feq(sim,sims[idx]))
+      self.failUnlessEqual(hits[0][1],0)
+
+      hits = index.TopKSearch(bvs[0],5)
+      self.failUnlessEqual(len(hits),5)
+      ssims = sorted(sims,reverse=True)
+      for i,(sim,idx) in enumerate(hits):
+        self.failUnless(feq(sim,ssims[i]))
+
+      hits = index.TopKSearchMany(bvs[:10],3,numThreads=2)
+      self.failUnlessEqual(len(hits),10)
+      for i in range(10):
+        self.failUnlessEqual(hits[i],index.TopKSearch(bvs[i],3))
+
+
 if __name__ == '__main__':
    unittest.main()
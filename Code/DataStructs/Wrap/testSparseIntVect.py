@@ -125,6 +125,13 @@ class TestCase(unittest.TestCase):
     v2 = ds.IntSparseIntVect(5)
     v2.UpdateFromSequence((0,2,3,3,2,3))
     self.failUnless(v1==v2)
+
+    # updates add to the existing counts:
+    v2.UpdateFromSequence([4,0,4])
+    self.failUnlessEqual(v2.GetNonzeroElements(),{0:2,2:2,3:3,4:2})
+    # and bad indices leave the vector alone:
+    self.failUnlessRaises(IndexError,lambda:v2.UpdateFromSequence((1,5)))
+    self.failUnlessEqual(v2.GetNonzeroElements(),{0:2,2:2,3:3,4:2})
     
   def test5Dice(self):
     """
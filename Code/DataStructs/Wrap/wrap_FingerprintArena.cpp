@@ -0,0 +1,196 @@
+//
+//  Copyright (C) 2013 Greg Landrum and Rational Discovery LLC
+//
+//  @@ All Rights Reserved @@
+//  This file is part of the RDKit.
+//  The contents are covered by the terms of the BSD license
+//  which is included in the file license.txt, found at the root
+//  of the RDKit source tree.
+//
+#define PY_ARRAY_UNIQUE_SYMBOL rddatastructs_array_API
+#define NO_IMPORT_ARRAY
+#include <boost/python.hpp>
+#include <RDBoost/Wrap.h>
+#include <DataStructs/BitVects.h>
+#include <DataStructs/FingerprintArena.h>
+#include <DataStructs/SimilaritySearch.h>
+#include <numpy/npy_common.h>
+#include <numpy/arrayobject.h>
+
+namespace python = boost::python;
+using RDKit::FingerprintArena;
+using RDKit::TanimotoSearchIndex;
+
+namespace {
+  void addFingerprints(FingerprintArena &self,python::object fps){
+    unsigned int nfps=python::extract<unsigned int>(fps.attr("__len__")());
+    self.reserve(self.size()+nfps);
+    for(unsigned int i=0;i<nfps;++i){
+      const ExplicitBitVect &fp=python::extract<ExplicitBitVect>(fps[i])();
+      self.addFingerprint(fp);
+    }
+  }
+
+  ExplicitBitVect *getFingerprint(const FingerprintArena &self,unsigned int idx){
+    return self.getFingerprint(idx);
+  }
+
+  // the results are written directly into the data of a numpy array
+  python::object makeResultArray(const FingerprintArena &arena,double *&data){
+    npy_intp dims[1];
+    dims[0]=arena.size();
+    python::object res(python::handle<>(PyArray_SimpleNew(1,dims,NPY_DOUBLE)));
+    data=(double *)PyArray_DATA((PyArrayObject *)res.ptr());
+    return res;
+  }
+
+  python::object bulkTanimoto(const ExplicitBitVect &bv1,const FingerprintArena &arena,
+                              bool returnDistance){
+    double *data;
+    python::object res=makeResultArray(arena,data);
+    RDKit::BulkTanimotoSimilarity(bv1,arena,data,returnDistance);
+    return res;
+  }
+  python::object bulkDice(const ExplicitBitVect &bv1,const FingerprintArena &arena,
+                          bool returnDistance){
+    double *data;
+    python::object res=makeResultArray(arena,data);
+    RDKit::BulkDiceSimilarity(bv1,arena,data,returnDistance);
+    return res;
+  }
+  python::object bulkTversky(const ExplicitBitVect &bv1,const FingerprintArena &arena,
+                             double a,double b,bool returnDistance){
+    double *data;
+    python::object res=makeResultArray(arena,data);
+    RDKit::BulkTverskySimilarity(bv1,arena,a,b,data,returnDistance);
+    return res;
+  }
+
+  python::tuple hitsToTuple(const RDKit::SimilarityHitVect &hits){
+    python::list res;
+    for(RDKit::SimilarityHitVect::const_iterator hit=hits.begin();
+        hit!=hits.end();++hit){
+      res.append(python::make_tuple(hit->first,hit->second));
+    }
+    return python::tuple(res);
+  }
+  void extractQueries(python::object queries,
+                      std::vector<const ExplicitBitVect *> &res){
+    unsigned int nQueries=python::extract<unsigned int>(queries.attr("__len__")());
+    res.reserve(nQueries);
+    for(unsigned int i=0;i<nQueries;++i){
+      const ExplicitBitVect &fp=python::extract<const ExplicitBitVect &>(queries[i])();
+      res.push_back(&fp);
+    }
+  }
+
+  python::tuple thresholdSearch(const TanimotoSearchIndex &self,
+                                const ExplicitBitVect &query,double threshold){
+    return hitsToTuple(self.thresholdSearch(query,threshold));
+  }
+  python::tuple topKSearch(const TanimotoSearchIndex &self,
+                           const ExplicitBitVect &query,unsigned int k,
+                           double threshold){
+    return hitsToTuple(self.topKSearch(query,k,threshold));
+  }
+  python::tuple thresholdSearchMany(const TanimotoSearchIndex &self,
+                                    python::object queries,double threshold,
+                                    int numThreads){
+    std::vector<const ExplicitBitVect *> qs;
+    extractQueries(queries,qs);
+    std::vector<RDKit::SimilarityHitVect> hits=self.thresholdSearch(qs,threshold,
+                                                                    numThreads);
+    python::list res;
+    for(unsigned int i=0;i<hits.size();++i) res.append(hitsToTuple(hits[i]));
+    return python::tuple(res);
+  }
+  python::tuple topKSearchMany(const TanimotoSearchIndex &self,
+                               python::object queries,unsigned int k,
+                               double threshold,int numThreads){
+    std::vector<const ExplicitBitVect *> qs;
+    extractQueries(queries,qs);
+    std::vector<RDKit::SimilarityHitVect> hits=self.topKSearch(qs,k,threshold,
+                                                               numThreads);
+    python::list res;
+    for(unsigned int i=0;i<hits.size();++i) res.append(hitsToTuple(hits[i]));
+    return python::tuple(res);
+  }
+}
+
+std::string arenaClassDoc="A compact container for a set of ExplicitBitVects of the same size.\n\
+\n\
+The fingerprints are packed into a single block of memory along with\n\
+their bit counts, which makes the bulk similarity functions\n\
+(BulkTanimotoSimilarity, BulkDiceSimilarity and BulkTverskySimilarity)\n\
+much faster than calling them with a list of ExplicitBitVects.\n\
+When called with an arena these return a numpy array.\n\
+\n\
+Usage:\n\
+  >>> arena = FingerprintArena(2048)\n\
+  >>> arena.AddFingerprints(fps)\n\
+  >>> sims = BulkTanimotoSimilarity(fps[0],arena)\n\
+\n";
+
+std::string searchIndexClassDoc="An index for fast Tanimoto searches over a FingerprintArena.\n\
+\n\
+The fingerprints are binned by the number of bits set, which allows\n\
+most of them to be skipped without calculating the similarity.\n\
+Search results are tuples of (similarity, index in the arena) sorted\n\
+by decreasing similarity.\n\
+\n";
+
+struct FingerprintArena_wrapper {
+  static void wrap(){
+    python::class_<FingerprintArena>("FingerprintArena",arenaClassDoc.c_str(),
+                                     python::init<unsigned int>(python::args("numBits")))
+      .def("AddFingerprint",
+           (unsigned int (FingerprintArena::*)(const ExplicitBitVect &))&FingerprintArena::addFingerprint,
+           "Adds a fingerprint to the arena and returns its index.\n")
+      .def("AddFingerprints",addFingerprints,
+           "Adds a sequence of fingerprints to the arena.\n")
+      .def("GetFingerprint",getFingerprint,
+           python::return_value_policy<python::manage_new_object>(),
+           "Returns a copy of one of the fingerprints.\n")
+      .def("GetPopcount",&FingerprintArena::getPopcount,
+           "Returns the number of bits set in one of the fingerprints.\n")
+      .def("GetNumBits",&FingerprintArena::getNumBits,
+           "Returns the number of bits in each fingerprint.\n")
+      .def("__len__",&FingerprintArena::size)
+      ;
+
+    python::class_<TanimotoSearchIndex>("TanimotoSearchIndex",searchIndexClassDoc.c_str(),
+                                        python::init<const FingerprintArena &>(python::args("arena")))
+      .def("ThresholdSearch",thresholdSearch,
+           (python::arg("self"),python::arg("query"),python::arg("threshold")),
+           "Returns all fingerprints with similarity >= threshold to the query.\n")
+      .def("TopKSearch",topKSearch,
+           (python::arg("self"),python::arg("query"),python::arg("k"),
+            python::arg("threshold")=0.0),
+           "Returns the k fingerprints most similar to the query.\n")
+      .def("ThresholdSearchMany",thresholdSearchMany,
+           (python::arg("self"),python::arg("queries"),python::arg("threshold"),
+            python::arg("numThreads")=1),
+           "Runs ThresholdSearch() for a sequence of queries, possibly using multiple threads.\n")
+      .def("TopKSearchMany",topKSearchMany,
+           (python::arg("self"),python::arg("queries"),python::arg("k"),
+            python::arg("threshold")=0.0,python::arg("numThreads")=1),
+           "Runs TopKSearch() for a sequence of queries, possibly using multiple threads.\n")
+      .def("__len__",&TanimotoSearchIndex::size)
+      ;
+
+    python::def("BulkTanimotoSimilarity",bulkTanimoto,
+                (python::args("bv1"),python::args("arena"),python::args("returnDistance")=0),
+                "Returns a numpy array with the Tanimoto similarities between bv1 and each fingerprint in the arena");
+    python::def("BulkDiceSimilarity",bulkDice,
+                (python::args("bv1"),python::args("arena"),python::args("returnDistance")=0),
+                "Returns a numpy array with the Dice similarities between bv1 and each fingerprint in the arena");
+    python::def("BulkTverskySimilarity",bulkTversky,
+                (python::args("bv1"),python::args("arena"),python::args("a"),
+                 python::args("b"),python::args("returnDistance")=0),
+                "Returns a numpy array with the Tversky similarities between bv1 and each fingerprint in the arena");
+  }
+};
+
+void wrap_FingerprintArena() {
+  FingerprintArena_wrapper::wrap();
+}
@@ -11,6 +11,7 @@
 #include <cstdlib>
 #include <iostream>
 #include <sstream>
+#include <map>
 #include <fstream>
 #include <ios>
 #include "BitVects.h"
@@ -23,6 +24,11 @@
 #include <RDGeneral/RDLog.h>
 #include <RDBoost/Exceptions.h>
 #include <DataStructs/SparseIntVect.h>
+#include <DataStructs/FingerprintArena.h>
+#include <DataStructs/SimilaritySearch.h>
+#include <DataStructs/FingerprintDB.h>
+#include <DataStructs/FingerprintStream.h>
+#include <DataStructs/BitmapOps.h>
 
 #include <stdlib.h>
 
@@ -534,6 +540,26 @@ void test6SparseIntVect() {
   } catch (IndexErrorException &dexp) {
     ;
   }
+  {
+    // negative indices in a sequence are rejected, and nothing is added:
+    std::vector<int> badV(2);
+    badV[0]=3;
+    badV[1]=-2;
+    try {
+      updateFromSequence(iVect,badV);
+      TEST_ASSERT(0);
+    } catch (IndexErrorException &dexp) {
+      ;
+    }
+    badV[1]=255;
+    try {
+      updateFromSequence(iVect,badV);
+      TEST_ASSERT(0);
+    } catch (IndexErrorException &dexp) {
+      ;
+    }
+    TEST_ASSERT(iVect.getTotalVal()==13);
+  }
 
   { 
     SparseIntVect<int> iV1(5);
@@ -953,6 +979,42 @@ void test7SparseIntVectPickles() {
       ;
     }
   }
+
+  {
+    // damaged pickles: the header of an empty vector of length 5 ends
+    // with the number of entries, which is replaced here
+    std::string header=SparseIntVect<int>(5).toString();
+    header.resize(header.size()-1);
+    SparseIntVect<int> iV(3);
+
+    // one entry at index 1, value 3:
+    iV.fromString(header+std::string("\x01\x01\x06",3));
+    TEST_ASSERT(iV.getLength()==5);
+    TEST_ASSERT(iV[1]==3);
+    TEST_ASSERT(iV.getTotalVal()==3);
+
+    // an index past the end of the vector:
+    try{
+      iV.fromString(header+std::string("\x01\x05\x02",3));
+      TEST_ASSERT(0);
+    } catch (ValueErrorException &dexp) {
+      ;
+    }
+    // the same index twice:
+    try{
+      iV.fromString(header+std::string("\x02\x01\x02\x00\x02",5));
+      TEST_ASSERT(0);
+    } catch (ValueErrorException &dexp) {
+      ;
+    }
+    // an enormous number of entries is an error, not an allocation:
+    try{
+      iV.fromString(header+std::string("\xff\xff\xff\xff\xff\xff\xff\x7f\x01\x02",10));
+      TEST_ASSERT(0);
+    } catch (ValueErrorException &dexp) {
+      ;
+    }
+  }
 }
 
 
@@ -1284,6 +1346,668 @@ void test12SimilaritiesSparseBV() {
 	TEST_ASSERT(feq(AllBitSimilarity(sbv,sbv2),0.6));
 }
 
+void test13BitmapKernels() {
+  BOOST_LOG(rdInfoLog) << "  using popcount implementation: "
+                       << GetBitmapPopcountImplementation() << std::endl;
+  // sizes chosen to hit the SIMD blocks, whole words and partial words
+  unsigned int sizes[]={1,7,8,13,32,33,64,100,256,257};
+  std::srand(23);
+  for(unsigned int si=0;si<sizeof(sizes)/sizeof(sizes[0]);++si){
+    unsigned int nBytes=sizes[si];
+    std::vector<unsigned char> bv1(nBytes),bv2(nBytes);
+    for(unsigned int i=0;i<nBytes;++i){
+      bv1[i]=std::rand()%256;
+      bv2[i]=std::rand()%256;
+    }
+    unsigned int nOn1=0,nOn2=0,nCommon=0;
+    bool subset=true;
+    for(unsigned int i=0;i<nBytes*8;++i){
+      bool b1=bv1[i/8]&(1<<(i%8));
+      bool b2=bv2[i/8]&(1<<(i%8));
+      if(b1) ++nOn1;
+      if(b2) ++nOn2;
+      if(b1&&b2) ++nCommon;
+      if(b1&&!b2) subset=false;
+    }
+    TEST_ASSERT(CalcBitmapPopcount(&bv1[0],nBytes)==nOn1);
+    TEST_ASSERT(CalcBitmapNumBitsInCommon(&bv1[0],&bv2[0],nBytes)==nCommon);
+    unsigned int c1,c2,cc;
+    CalcBitmapBitCounts(&bv1[0],&bv2[0],nBytes,c1,c2,cc);
+    TEST_ASSERT(c1==nOn1);
+    TEST_ASSERT(c2==nOn2);
+    TEST_ASSERT(cc==nCommon);
+    TEST_ASSERT(CalcBitmapAllProbeBitsMatch(&bv1[0],&bv2[0],nBytes)==subset);
+    TEST_ASSERT(CalcBitmapAllProbeBitsMatch(&bv1[0],&bv1[0],nBytes));
+    TEST_ASSERT(feq(CalcBitmapTanimoto(&bv1[0],&bv2[0],nBytes),
+                    double(nCommon)/(nOn1+nOn2-nCommon)));
+    TEST_ASSERT(feq(CalcBitmapDice(&bv1[0],&bv2[0],nBytes),
+                    2.*nCommon/(nOn1+nOn2)));
+    TEST_ASSERT(feq(CalcBitmapTversky(&bv1[0],&bv2[0],nBytes,1.,1.),
+                    CalcBitmapTanimoto(&bv1[0],&bv2[0],nBytes)));
+  }
+
+  // make sure the ExplicitBitVect functions agree with the naive versions
+  for(unsigned int nBits=1;nBits<1200;nBits+=97){
+    ExplicitBitVect bv1(nBits),bv2(nBits);
+    for(unsigned int i=0;i<nBits;++i){
+      if(std::rand()%3==0) bv1.setBit(i);
+      if(std::rand()%3==0) bv2.setBit(i);
+    }
+    unsigned int nCommon=0,nUnion=0,nSame=0;
+    for(unsigned int i=0;i<nBits;++i){
+      if(bv1[i]&&bv2[i]) ++nCommon;
+      if(bv1[i]||bv2[i]) ++nUnion;
+      if(bv1[i]==bv2[i]) ++nSame;
+    }
+    TEST_ASSERT(NumOnBitsInCommon(bv1,bv2)==static_cast<int>(nCommon));
+    TEST_ASSERT(NumBitsInCommon(bv1,bv2)==static_cast<int>(nSame));
+    if(nUnion){
+      TEST_ASSERT(feq(TanimotoSimilarity(bv1,bv2),double(nCommon)/nUnion));
+      TEST_ASSERT(feq(OnBitSimilarity(bv1,bv2),double(nCommon)/nUnion));
+    }
+    TEST_ASSERT(AllProbeBitsMatch(bv1&bv2,bv1));
+    TEST_ASSERT(AllProbeBitsMatch(bv1,bv1|bv2));
+    DoubleVect proj=OffBitProjSimilarity(bv1,bv2);
+    if(bv1.getNumOffBits()){
+      TEST_ASSERT(feq(proj[0],double(nBits-nUnion)/bv1.getNumOffBits()));
+    }
+  }
+}
+
+void test14FingerprintArena() {
+  std::srand(42);
+  const unsigned int nBits=1021;
+  std::vector<ExplicitBitVect *> fps;
+  FingerprintArena arena(nBits);
+  TEST_ASSERT(arena.getNumBits()==nBits);
+  TEST_ASSERT(arena.getNumBytes()==128);
+  TEST_ASSERT(arena.getStride()==128);
+  for(unsigned int i=0;i<50;++i){
+    ExplicitBitVect *fp=new ExplicitBitVect(nBits);
+    for(unsigned int j=0;j<nBits;++j){
+      if(std::rand()%(2+i%5)==0) fp->setBit(j);
+    }
+    fps.push_back(fp);
+    TEST_ASSERT(arena.addFingerprint(*fp)==i);
+  }
+  fps.push_back(new ExplicitBitVect(nBits));
+  arena.addFingerprint(*fps.back());
+  TEST_ASSERT(arena.size()==fps.size());
+
+  for(unsigned int i=0;i<fps.size();++i){
+    TEST_ASSERT(arena.getPopcount(i)==fps[i]->getNumOnBits());
+    ExplicitBitVect *fp=arena.getFingerprint(i);
+    TEST_ASSERT(*fp==*fps[i]);
+    delete fp;
+    TEST_ASSERT(BitVectToBinaryText(*fps[i])==
+                std::string((const char *)arena.getBitmap(i),arena.getNumBytes()));
+    // the stride is 128 bytes, so every record is cache line aligned:
+    TEST_ASSERT(!(reinterpret_cast<size_t>(arena.getBitmap(i))%64));
+  }
+
+  std::vector<double> sims(arena.size());
+  BulkTanimotoSimilarity(*fps[3],arena,&sims[0]);
+  for(unsigned int i=0;i<fps.size();++i){
+    TEST_ASSERT(feq(sims[i],TanimotoSimilarity(*fps[3],*fps[i])));
+  }
+  BulkTanimotoSimilarity(arena.getBitmap(3),arena,&sims[0],true);
+  for(unsigned int i=0;i<fps.size();++i){
+    TEST_ASSERT(feq(sims[i],1.-TanimotoSimilarity(*fps[3],*fps[i])));
+  }
+  BulkDiceSimilarity(*fps[7],arena,&sims[0]);
+  for(unsigned int i=0;i<fps.size();++i){
+    TEST_ASSERT(feq(sims[i],DiceSimilarity(*fps[7],*fps[i])));
+  }
+  BulkTverskySimilarity(*fps[7],arena,0.2,0.8,&sims[0]);
+  for(unsigned int i=0;i<fps.size();++i){
+    TEST_ASSERT(feq(sims[i],TverskySimilarity(*fps[7],*fps[i],0.2,0.8)));
+  }
+
+  // setting from a bitmap clears the padding bits:
+  std::vector<unsigned char> bitmap(arena.getNumBytes(),0xff);
+  arena.setFingerprint(0,&bitmap[0]);
+  TEST_ASSERT(arena.getPopcount(0)==nBits);
+
+  // size mismatches:
+  ExplicitBitVect small(10);
+  bool ok=false;
+  try {
+    arena.addFingerprint(small);
+  } catch (ValueErrorException &) {
+    ok=true;
+  }
+  TEST_ASSERT(ok);
+  ok=false;
+  try {
+    BulkTanimotoSimilarity(small,arena,&sims[0]);
+  } catch (ValueErrorException &) {
+    ok=true;
+  }
+  TEST_ASSERT(ok);
+
+  for(unsigned int i=0;i<fps.size();++i) delete fps[i];
+}
+
+void test15SimilaritySearch() {
+  std::srand(1234);
+  const unsigned int nBits=512;
+  std::vector<ExplicitBitVect *> fps;
+  FingerprintArena arena(nBits);
+  for(unsigned int i=0;i<300;++i){
+    ExplicitBitVect *fp=new ExplicitBitVect(nBits);
+    // a core set of bits plus a variable amount of noise so that
+    // there's a spread of similarities and popcounts
+    for(unsigned int j=0;j<30;++j) fp->setBit(j);
+    unsigned int nNoise=std::rand()%100;
+    for(unsigned int j=0;j<nNoise;++j) fp->setBit(std::rand()%nBits);
+    fps.push_back(fp);
+    arena.addFingerprint(*fp);
+  }
+  fps.push_back(new ExplicitBitVect(nBits));
+  arena.addFingerprint(*fps.back());
+  TanimotoSearchIndex index(arena);
+  TEST_ASSERT(index.size()==fps.size());
+
+  double thresholds[]={0.0,0.3,0.5,0.7,1.0};
+  for(unsigned int qi=0;qi<fps.size();qi+=17){
+    const ExplicitBitVect &query=*fps[qi];
+    std::vector<SimilarityHit> brute;
+    for(unsigned int i=0;i<fps.size();++i){
+      brute.push_back(std::make_pair(TanimotoSimilarity(query,*fps[i]),i));
+    }
+    for(unsigned int ti=0;ti<sizeof(thresholds)/sizeof(thresholds[0]);++ti){
+      SimilarityHitVect hits=index.thresholdSearch(query,thresholds[ti]);
+      unsigned int nExpected=0;
+      for(unsigned int i=0;i<brute.size();++i){
+        if(brute[i].first>=thresholds[ti]) ++nExpected;
+      }
+      TEST_ASSERT(hits.size()==nExpected);
+      for(unsigned int i=0;i<hits.size();++i){
+        TEST_ASSERT(feq(hits[i].first,brute[hits[i].second].first));
+        if(i) TEST_ASSERT(hits[i].first<=hits[i-1].first);
+      }
+    }
+    TEST_ASSERT(index.thresholdSearch(query,1.0).size()>=1);
+
+    // top-k
+    for(unsigned int k=1;k<50;k+=12){
+      SimilarityHitVect hits=index.topKSearch(query,k);
+      TEST_ASSERT(hits.size()==k);
+      SimilarityHitVect all=index.thresholdSearch(query,0.0);
+      for(unsigned int i=0;i<k;++i){
+        TEST_ASSERT(hits[i]==all[i]);
+      }
+      hits=index.topKSearch(query,k,0.6);
+      TEST_ASSERT(hits.size()<=k);
+      for(unsigned int i=0;i<hits.size();++i){
+        TEST_ASSERT(hits[i]==all[i]);
+        TEST_ASSERT(hits[i].first>=0.6);
+      }
+    }
+  }
+
+  // batched searches
+  std::vector<const ExplicitBitVect *> queries;
+  for(unsigned int qi=0;qi<fps.size();qi+=7) queries.push_back(fps[qi]);
+  for(int nThreads=1;nThreads<=4;nThreads+=3){
+    std::vector<SimilarityHitVect> hits=index.thresholdSearch(queries,0.5,nThreads);
+    TEST_ASSERT(hits.size()==queries.size());
+    for(unsigned int i=0;i<queries.size();++i){
+      TEST_ASSERT(hits[i]==index.thresholdSearch(*queries[i],0.5));
+    }
+    hits=index.topKSearch(queries,5,0.0,nThreads);
+    TEST_ASSERT(hits.size()==queries.size());
+    for(unsigned int i=0;i<queries.size();++i){
+      TEST_ASSERT(hits[i]==index.topKSearch(*queries[i],5));
+    }
+  }
+
+  for(unsigned int i=0;i<fps.size();++i) delete fps[i];
+}
+
+namespace {
+  // copies a fingerprint database, replacing the value at offset in
+  // the copy, and checks that the copy cannot be opened or, if
+  // readIds is set, that reading its ids fails
+  template <typename T>
+  bool corruptFingerprintDBIsRejected(const std::string &fName,size_t offset,T val,
+                                      bool readIds=false){
+    std::string data;
+    {
+      std::ifstream ins(fName.c_str(),std::ios_base::binary);
+      std::stringstream ss;
+      ss<<ins.rdbuf();
+      data=ss.str();
+    }
+    memcpy(&data[offset],&val,sizeof(T));
+    std::string corruptName="corrupt_"+fName;
+    {
+      std::ofstream outs(corruptName.c_str(),std::ios_base::binary);
+      outs.write(data.c_str(),data.size());
+    }
+    bool res=false;
+    try {
+      FingerprintDB db(corruptName);
+      if(readIds){
+        for(unsigned int i=0;i<db.size();++i) db.getId(i);
+      }
+    } catch (ValueErrorException &) {
+      res=true;
+    }
+    std::remove(corruptName.c_str());
+    return res;
+  }
+}
+
+void test16FingerprintDB() {
+  std::srand(4321);
+  const unsigned int nBits=300;
+  FingerprintArena arena(nBits);
+  std::vector<std::string> ids;
+  for(unsigned int i=0;i<200;++i){
+    ExplicitBitVect fp(nBits);
+    unsigned int nOn=std::rand()%120;
+    for(unsigned int j=0;j<nOn;++j) fp.setBit(std::rand()%nBits);
+    arena.addFingerprint(fp);
+    std::stringstream ss;
+    ss<<"mol_"<<i;
+    ids.push_back(ss.str());
+  }
+  std::string fName="testFingerprintDB.fpdb";
+  WriteFingerprintDB(arena,ids,fName);
+  {
+    FingerprintDB db(fName);
+    TEST_ASSERT(db.size()==arena.size());
+    TEST_ASSERT(db.getNumBits()==nBits);
+    TEST_ASSERT(db.getStride()%8==0);
+    // the records are views into the mapping which the kernels can use directly:
+    TEST_ASSERT(reinterpret_cast<size_t>(db.getBitmap(0))%8==0);
+    std::vector<bool> seen(arena.size(),false);
+    for(unsigned int i=0;i<db.size();++i){
+      std::string id=db.getId(i);
+      unsigned int idx=atoi(id.substr(4).c_str());
+      TEST_ASSERT(ids[idx]==id);
+      TEST_ASSERT(!seen[idx]);
+      seen[idx]=true;
+      TEST_ASSERT(db.getPopcount(i)==arena.getPopcount(idx));
+      if(i) TEST_ASSERT(db.getPopcount(i)>=db.getPopcount(i-1));
+      TEST_ASSERT(!memcmp(db.getBitmap(i),arena.getBitmap(idx),db.getStride()));
+      TEST_ASSERT(CalcBitmapPopcount(db.getBitmap(i),db.getStride())==db.getPopcount(i));
+      ExplicitBitVect *fp=db.getFingerprint(i);
+      ExplicitBitVect *afp=arena.getFingerprint(idx);
+      TEST_ASSERT(*fp==*afp);
+      delete fp;
+      delete afp;
+    }
+    std::pair<unsigned int,unsigned int> range=db.getPopcountRange(db.getPopcount(0));
+    TEST_ASSERT(range.first==0 && range.second>0);
+
+    // searches give the same results as the index, modulo the ids:
+    TanimotoSearchIndex index(arena);
+    for(unsigned int qi=0;qi<arena.size();qi+=23){
+      ExplicitBitVect *query=arena.getFingerprint(qi);
+      SimilarityHitVect dbHits=db.thresholdSearch(*query,0.4);
+      SimilarityHitVect hits=index.thresholdSearch(*query,0.4);
+      TEST_ASSERT(dbHits.size()==hits.size());
+      for(unsigned int i=0;i<hits.size();++i){
+        TEST_ASSERT(feq(dbHits[i].first,hits[i].first));
+        unsigned int idx=atoi(db.getId(dbHits[i].second).substr(4).c_str());
+        ExplicitBitVect *fp=arena.getFingerprint(idx);
+        TEST_ASSERT(feq(dbHits[i].first,TanimotoSimilarity(*query,*fp)));
+        delete fp;
+      }
+      dbHits=db.topKSearch(*query,5);
+      hits=index.topKSearch(*query,5);
+      TEST_ASSERT(dbHits.size()==5);
+      for(unsigned int i=0;i<hits.size();++i){
+        TEST_ASSERT(feq(dbHits[i].first,hits[i].first));
+      }
+      delete query;
+    }
+  }
+
+  // default ids are the positions in the arena:
+  WriteFingerprintDB(arena,std::vector<std::string>(),fName);
+  {
+    FingerprintDB db(fName);
+    for(unsigned int i=0;i<db.size();++i){
+      unsigned int idx=atoi(db.getId(i).c_str());
+      TEST_ASSERT(!memcmp(db.getBitmap(i),arena.getBitmap(idx),db.getStride()));
+    }
+  }
+
+  // corrupt files: the header is 64 bytes and the popcount bins follow it
+  {
+    boost::uint64_t idOffsetsOffset,numRecords=arena.size();
+    {
+      std::ifstream ins(fName.c_str(),std::ios_base::binary);
+      ins.seekg(48);
+      ins.read(reinterpret_cast<char *>(&idOffsetsOffset),sizeof(idOffsetsOffset));
+    }
+    // too many records:
+    TEST_ASSERT(corruptFingerprintDBIsRejected(fName,24,boost::uint64_t(1)<<32));
+    // the records run into the id table:
+    TEST_ASSERT(corruptFingerprintDBIsRejected(fName,20,boost::uint32_t(1)<<31));
+    // the offset sums overflow:
+    TEST_ASSERT(corruptFingerprintDBIsRejected(fName,48,~boost::uint64_t(7)));
+    TEST_ASSERT(corruptFingerprintDBIsRejected(fName,56,~boost::uint64_t(0)));
+    // the popcount bins do not start at zero, decrease or run past the end:
+    TEST_ASSERT(corruptFingerprintDBIsRejected(fName,64,boost::uint32_t(1)));
+    TEST_ASSERT(corruptFingerprintDBIsRejected(fName,64+4*nBits,boost::uint32_t(0)));
+    TEST_ASSERT(corruptFingerprintDBIsRejected(fName,64+4*(nBits+1),
+                                               boost::uint32_t(numRecords+1)));
+    // the id offsets do not start at zero or run past the end of the file:
+    TEST_ASSERT(corruptFingerprintDBIsRejected(fName,idOffsetsOffset,boost::uint64_t(1)));
+    TEST_ASSERT(corruptFingerprintDBIsRejected(fName,idOffsetsOffset+8*numRecords,
+                                               boost::uint64_t(1)<<40));
+    // the other id offsets are only checked when the ids are read:
+    TEST_ASSERT(!corruptFingerprintDBIsRejected(fName,idOffsetsOffset+8*5,boost::uint64_t(0)));
+    TEST_ASSERT(corruptFingerprintDBIsRejected(fName,idOffsetsOffset+8*5,boost::uint64_t(0),
+                                               true));
+    TEST_ASSERT(corruptFingerprintDBIsRejected(fName,idOffsetsOffset+8*5,
+                                               boost::uint64_t(1)<<40,true));
+    FingerprintDB db(fName);
+    TEST_ASSERT(db.size()==numRecords);
+  }
+
+  // bad input
+  bool ok=false;
+  try {
+    WriteFingerprintDB(arena,std::vector<std::string>(3,"foo"),fName);
+  } catch (ValueErrorException &) {
+    ok=true;
+  }
+  TEST_ASSERT(ok);
+  {
+    std::ofstream outs(fName.c_str(),std::ios_base::binary);
+    outs<<"this is not a fingerprint database, but it is long enough to have a header";
+  }
+  ok=false;
+  try {
+    FingerprintDB db(fName);
+  } catch (ValueErrorException &) {
+    ok=true;
+  }
+  TEST_ASSERT(ok);
+  ok=false;
+  try {
+    FingerprintDB db("no_such_file.fpdb");
+  } catch (ValueErrorException &) {
+    ok=true;
+  }
+  TEST_ASSERT(ok);
+  std::remove(fName.c_str());
+}
+
+void test17SparseIntVectStorage() {
+  std::srand(42);
+  // compare against a std::map reference implementation
+  const boost::uint32_t length=1000;
+  for(unsigned int iter=0;iter<20;++iter){
+    SparseIntVect<boost::uint32_t> v1(length),v2(length);
+    std::map<boost::uint32_t,int> m1,m2;
+    std::vector<boost::uint32_t> seq;
+    unsigned int nElems=std::rand()%200;
+    for(unsigned int i=0;i<nElems;++i){
+      boost::uint32_t idx=std::rand()%length;
+      seq.push_back(idx);
+      m1[idx]+=1;
+    }
+    updateFromSequence(v1,seq);
+    nElems=std::rand()%200;
+    for(unsigned int i=0;i<nElems;++i){
+      boost::uint32_t idx=std::rand()%length;
+      int val=std::rand()%7-3;
+      v2.setVal(idx,val);
+      if(val) m2[idx]=val;
+      else m2.erase(idx);
+    }
+    TEST_ASSERT(v1.getNonzeroElements().size()==m1.size());
+    TEST_ASSERT(v2.getNonzeroElements().size()==m2.size());
+    for(boost::uint32_t i=0;i<length;++i){
+      TEST_ASSERT(v1[i]==(m1.count(i)?m1[i]:0));
+      TEST_ASSERT(v2[i]==(m2.count(i)?m2[i]:0));
+    }
+    for(unsigned int i=1;i<v2.getNonzeroElements().size();++i){
+      TEST_ASSERT(v2.getNonzeroElements()[i-1].first<v2.getNonzeroElements()[i].first);
+    }
+
+    SparseIntVect<boost::uint32_t> vAnd=v1&v2,vOr=v1|v2,vSum=v1+v2,vDiff=v1-v2;
+    double andSum=0,sum1=0,sum2=0;
+    for(boost::uint32_t i=0;i<length;++i){
+      int a=m1.count(i)?m1[i]:0;
+      int b=m2.count(i)?m2[i]:0;
+      TEST_ASSERT(vSum[i]==a+b);
+      TEST_ASSERT(vDiff[i]==a-b);
+      if(a && b){
+        TEST_ASSERT(vAnd[i]==std::min(a,b));
+        TEST_ASSERT(vOr[i]==std::max(a,b));
+      } else {
+        TEST_ASSERT(vAnd[i]==0);
+        TEST_ASSERT(vOr[i]==(a?a:b));
+      }
+      andSum+=std::min(abs(a),abs(b));
+      sum1+=abs(a);
+      sum2+=abs(b);
+    }
+    if(sum1+sum2>0){
+      TEST_ASSERT(feq(DiceSimilarity(v1,v2),2*andSum/(sum1+sum2)));
+    }
+
+    // pickles:
+    SparseIntVect<boost::uint32_t> v3(v2.toString());
+    TEST_ASSERT(v3==v2);
+    v3.fromString(vDiff.toString());
+    TEST_ASSERT(v3==vDiff);
+  }
+
+  {
+    // the old pickle format can still be read:
+    SparseIntVect<boost::int32_t> v1(100);
+    v1.setVal(3,2);
+    v1.setVal(50,-1);
+    v1.setVal(99,7);
+    std::stringstream ss(std::ios_base::binary|std::ios_base::out|std::ios_base::in);
+    streamWrite(ss,static_cast<boost::uint32_t>(1));
+    streamWrite(ss,static_cast<boost::uint32_t>(4));
+    streamWrite(ss,static_cast<boost::int32_t>(100));
+    streamWrite(ss,static_cast<boost::int32_t>(3));
+    for(unsigned int i=0;i<v1.getNonzeroElements().size();++i){
+      streamWrite(ss,static_cast<boost::int32_t>(v1.getNonzeroElements()[i].first));
+      streamWrite(ss,static_cast<boost::int32_t>(v1.getNonzeroElements()[i].second));
+    }
+    SparseIntVect<boost::int32_t> v2(ss.str());
+    TEST_ASSERT(v2==v1);
+    // and the new one is smaller:
+    TEST_ASSERT(v1.toString().size()<ss.str().size());
+  }
+
+  {
+    bool ok=false;
+    SparseIntVect<boost::int32_t> v1(10);
+    std::vector<boost::int32_t> seq(1,10);
+    try {
+      updateFromSequence(v1,seq);
+    } catch (IndexErrorException &) {
+      ok=true;
+    }
+    TEST_ASSERT(ok);
+  }
+}
+
+void test18NeighborList() {
+  std::srand(5678);
+  const unsigned int nBits=256;
+  std::vector<const ExplicitBitVect *> fps;
+  for(unsigned int i=0;i<250;++i){
+    ExplicitBitVect *fp=new ExplicitBitVect(nBits);
+    for(unsigned int j=0;j<20;++j) fp->setBit(j);
+    unsigned int nNoise=std::rand()%60;
+    for(unsigned int j=0;j<nNoise;++j) fp->setBit(std::rand()%nBits);
+    fps.push_back(fp);
+  }
+  fps.push_back(new ExplicitBitVect(nBits));
+  fps.push_back(new ExplicitBitVect(nBits));
+
+  double thresholds[]={0.0,0.4,0.6,0.9,1.0};
+  for(unsigned int ti=0;ti<sizeof(thresholds)/sizeof(thresholds[0]);++ti){
+    SimilarityNeighborList nbrs;
+    GetTanimotoNeighborList(fps,thresholds[ti],nbrs);
+    TEST_ASSERT(nbrs.size()==fps.size());
+    for(unsigned int i=0;i<fps.size();++i){
+      std::vector<unsigned int> expected;
+      for(unsigned int j=0;j<fps.size();++j){
+        if(i!=j && TanimotoSimilarity(*fps[i],*fps[j])>=thresholds[ti]){
+          expected.push_back(j);
+        }
+      }
+      TEST_ASSERT(nbrs.getNumNeighbors(i)==expected.size());
+      for(unsigned int k=0;k<expected.size();++k){
+        boost::uint64_t pos=nbrs.offsets[i]+k;
+        TEST_ASSERT(nbrs.neighbors[pos]==expected[k]);
+        TEST_ASSERT(feq(nbrs.similarities[pos],
+                        TanimotoSimilarity(*fps[i],*fps[expected[k]]),1e-6));
+      }
+    }
+    // the empty fingerprints are identical to each other:
+    TEST_ASSERT(nbrs.getNumNeighbors(fps.size()-1)>=1);
+
+    for(int nThreads=2;nThreads<=4;nThreads+=2){
+      SimilarityNeighborList tnbrs;
+      GetTanimotoNeighborList(fps,thresholds[ti],tnbrs,nThreads);
+      TEST_ASSERT(tnbrs.offsets==nbrs.offsets);
+      TEST_ASSERT(tnbrs.neighbors==nbrs.neighbors);
+      TEST_ASSERT(tnbrs.similarities==nbrs.similarities);
+    }
+  }
+
+  SimilarityNeighborList nbrs;
+  GetTanimotoNeighborList(std::vector<const ExplicitBitVect *>(),0.5,nbrs);
+  TEST_ASSERT(nbrs.size()==0);
+
+  for(unsigned int i=0;i<fps.size();++i) delete fps[i];
+}
+
+void test19FingerprintStream() {
+  std::srand(1234);
+  const unsigned int nBits=300;
+  FingerprintArena arena(nBits);
+  for(unsigned int i=0;i<50;++i){
+    ExplicitBitVect fp(nBits);
+    unsigned int nOn=std::rand()%120;
+    for(unsigned int j=0;j<nOn;++j) fp.setBit(std::rand()%nBits);
+    arena.addFingerprint(fp);
+  }
+  std::string fName="testFingerprintStream.fpst";
+  {
+    // write the first 20 records, skipping every 7th as if it failed:
+    FingerprintStreamWriter writer(fName,nBits);
+    TEST_ASSERT(writer.getNextInputIdx()==0);
+    for(unsigned int i=0;i<20;++i){
+      if(!(i%7)) continue;
+      std::stringstream ss;
+      ss<<"mol_"<<i;
+      ExplicitBitVect *fp=arena.getFingerprint(i);
+      writer.addRecord(i,ss.str(),*fp);
+      delete fp;
+      if(i==9) writer.checkpoint(10);
+    }
+    writer.checkpoint(20);
+    // these aren't committed:
+    writer.addRecord(20,"mol_20",arena.getBitmap(20));
+    writer.addRecord(21,"mol_21",arena.getBitmap(21));
+  }
+  {
+    FingerprintArena fps(nBits);
+    std::vector<std::string> ids;
+    std::vector<boost::uint64_t> idx;
+    TEST_ASSERT(ReadFingerprintStream(fName,fps,ids,&idx)==20);
+    TEST_ASSERT(fps.size()==17);
+    TEST_ASSERT(ids.size()==17 && idx.size()==17);
+    for(unsigned int i=0;i<fps.size();++i){
+      TEST_ASSERT(idx[i]%7);
+      std::stringstream ss;
+      ss<<"mol_"<<idx[i];
+      TEST_ASSERT(ids[i]==ss.str());
+      TEST_ASSERT(!memcmp(fps.getBitmap(i),arena.getBitmap(idx[i]),arena.getStride()));
+    }
+  }
+  {
+    // restart from the checkpoint:
+    FingerprintStreamWriter writer(fName,nBits,true);
+    TEST_ASSERT(writer.getNextInputIdx()==20);
+    TEST_ASSERT(writer.size()==17);
+    for(unsigned int i=writer.getNextInputIdx();i<arena.size();++i){
+      writer.addRecord(i,"",arena.getBitmap(i));
+    }
+    writer.checkpoint(arena.size());
+  }
+  {
+    FingerprintArena fps(nBits);
+    std::vector<std::string> ids;
+    std::vector<boost::uint64_t> idx;
+    TEST_ASSERT(ReadFingerprintStream(fName,fps,ids,&idx)==arena.size());
+    TEST_ASSERT(fps.size()==47);
+    for(unsigned int i=0;i<fps.size();++i){
+      TEST_ASSERT(!memcmp(fps.getBitmap(i),arena.getBitmap(idx[i]),arena.getStride()));
+      TEST_ASSERT(fps.getPopcount(i)==arena.getPopcount(idx[i]));
+      if(i>=17) TEST_ASSERT(ids[i]=="");
+    }
+  }
+
+  // bad input
+  bool ok=false;
+  try {
+    FingerprintStreamWriter writer(fName,nBits+1,true);
+  } catch (ValueErrorException &) {
+    ok=true;
+  }
+  TEST_ASSERT(ok);
+  ok=false;
+  try {
+    FingerprintStreamWriter writer(fName,nBits,true,1,42);
+  } catch (ValueErrorException &) {
+    ok=true;
+  }
+  TEST_ASSERT(ok);
+  ok=false;
+  try {
+    FingerprintArena fps(nBits+1);
+    std::vector<std::string> ids;
+    ReadFingerprintStream(fName,fps,ids);
+  } catch (ValueErrorException &) {
+    ok=true;
+  }
+  TEST_ASSERT(ok);
+  {
+    std::ofstream outs(fName.c_str(),std::ios_base::binary);
+    outs<<"this is not a fingerprint stream, but it is long enough to have a header";
+  }
+  ok=false;
+  try {
+    FingerprintArena fps(nBits);
+    std::vector<std::string> ids;
+    ReadFingerprintStream(fName,fps,ids);
+  } catch (ValueErrorException &) {
+    ok=true;
+  }
+  TEST_ASSERT(ok);
+  std::remove(fName.c_str());
+  {
+    // resuming a file that doesn't exist starts a new one:
+    FingerprintStreamWriter writer(fName,nBits,true);
+    TEST_ASSERT(writer.getNextInputIdx()==0);
+    TEST_ASSERT(writer.size()==0);
+  }
+  {
+    FingerprintArena fps(nBits);
+    std::vector<std::string> ids;
+    TEST_ASSERT(ReadFingerprintStream(fName,fps,ids)==0);
+    TEST_ASSERT(fps.size()==0);
+  }
+  std::remove(fName.c_str());
+}
+
 int main(){
   RDLog::InitLogs();
   try{
@@ -1348,6 +2072,27 @@ int main(){
   BOOST_LOG(rdInfoLog) << " Test Similarity Measures SparseBitVect -------------------------------" << std::endl;
     test12SimilaritiesSparseBV();
 
+  BOOST_LOG(rdInfoLog) << " Test Bitmap Popcount Kernels -------------------------------" << std::endl;
+  test13BitmapKernels();
+
+  BOOST_LOG(rdInfoLog) << " Test FingerprintArena -------------------------------" << std::endl;
+  test14FingerprintArena();
+
+  BOOST_LOG(rdInfoLog) << " Test TanimotoSearchIndex -------------------------------" << std::endl;
+  test15SimilaritySearch();
+
+  BOOST_LOG(rdInfoLog) << " Test FingerprintDB -------------------------------" << std::endl;
+  test16FingerprintDB();
+
+  BOOST_LOG(rdInfoLog) << " Test SparseIntVect storage -------------------------------" << std::endl;
+  test17SparseIntVectStorage();
+
+  BOOST_LOG(rdInfoLog) << " Test similarity neighbor lists -------------------------------" << std::endl;
+  test18NeighborList();
+
+  BOOST_LOG(rdInfoLog) << " Test FingerprintStream -------------------------------" << std::endl;
+  test19FingerprintStream();
+
   return 0;
   
 }